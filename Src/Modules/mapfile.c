@@ -162,6 +162,90 @@ setpmmapfiles(Param pm, HashTable ht)
 	deleteparamtable(ht);
 }
 
+#ifdef USE_MMAP
+/*
+ * Contents of the files most recently read.  A metafied copy is made
+ * when the file is first referenced and kept for as long as the file
+ * appears unchanged, so that repeated references to the same file, and
+ * in particular subscripts of it, don't need to read or copy the
+ * contents again.  The file itself is not left mapped: the value must
+ * not change under the shell, nor fault if the file is truncated.
+ *
+ * Only files up to MAPCACHE_FILEMAX bytes are kept, and no more than
+ * MAPCACHE_BYTES in all; larger files are copied onto the heap on each
+ * reference as they always were.
+ */
+struct mapent {
+    char *name;			/* file name as given, metafied */
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime, ctime;
+#ifdef GET_ST_MTIME_NSEC
+    long mtime_nsec;
+#endif
+#ifdef GET_ST_CTIME_NSEC
+    long ctime_nsec;
+#endif
+    char *val;			/* metafied copy of the contents */
+    unsigned int used;		/* for least recently used replacement */
+};
+
+#define MAPCACHE_SIZE 8
+#define MAPCACHE_FILEMAX (1024 * 1024)
+#define MAPCACHE_BYTES (4 * 1024 * 1024)
+static struct mapent mapcache[MAPCACHE_SIZE];
+static unsigned int mapcache_clock;
+static off_t mapcache_bytes;
+
+/*
+ * A value handed out from the cache is referenced from the heap
+ * by whatever expansion asked for it, so when a file changes or is
+ * pushed out of the cache the old copy can't go away immediately.
+ * Instead it waits here until MAPCACHE_RETIRED later ones have been
+ * retired; that is far longer than any one expansion holds onto it.
+ * As each is no larger than MAPCACHE_FILEMAX, this is bounded, too.
+ */
+#define MAPCACHE_RETIRED 16
+static struct mapent retired[MAPCACHE_RETIRED];
+static int retired_next;
+
+static void
+mapent_release(struct mapent *me)
+{
+    zsfree(me->val);
+    zsfree(me->name);
+    memset(me, 0, sizeof(*me));
+}
+
+static void
+mapent_retire(struct mapent *me)
+{
+    if (!me->name)
+	return;
+    mapcache_bytes -= me->size;
+    mapent_release(&retired[retired_next]);
+    retired[retired_next] = *me;
+    retired_next = (retired_next + 1) % MAPCACHE_RETIRED;
+    memset(me, 0, sizeof(*me));
+}
+
+static int
+mapent_matches(struct mapent *me, struct stat *sbuf)
+{
+    return me->dev == sbuf->st_dev && me->ino == sbuf->st_ino &&
+	me->size == sbuf->st_size &&
+	me->mtime == sbuf->st_mtime && me->ctime == sbuf->st_ctime
+#ifdef GET_ST_MTIME_NSEC
+	&& me->mtime_nsec == GET_ST_MTIME_NSEC(*sbuf)
+#endif
+#ifdef GET_ST_CTIME_NSEC
+	&& me->ctime_nsec == GET_ST_CTIME_NSEC(*sbuf)
+#endif
+	;
+}
+#endif /* USE_MMAP */
+
 /**/
 static char *
 get_contents(char *fname)
@@ -170,30 +254,80 @@ get_contents(char *fname)
 #ifdef USE_MMAP
     caddr_t mmptr;
     struct stat sbuf;
+    struct mapent *me, *slot = NULL;
+    char *name = fname;
 #endif
     char *val;
     unmetafy(fname = ztrdup(fname), &fd);
 
 #ifdef USE_MMAP
     if ((fd = open(fname, O_RDONLY | O_NOCTTY)) < 0 ||
-	fstat(fd, &sbuf) ||
-	(mmptr = (caddr_t)mmap((caddr_t)0, sbuf.st_size, PROT_READ,
-			       MMAP_ARGS, fd, (off_t)0)) == (caddr_t)-1) {
+	fstat(fd, &sbuf)) {
 	if (fd >= 0)
 	    close(fd);
 	free(fname);
+	for (me = mapcache; me < mapcache + MAPCACHE_SIZE; me++)
+	    if (me->name && !strcmp(me->name, name))
+		mapent_retire(me);
 	return NULL;
     }
+    free(fname);
 
-    /*
-     * Sadly, we need to copy the thing even if metafying doesn't
-     * change it.  We just don't know when we might get a chance to
-     * munmap it, otherwise.
-     */
-    val = metafy((char *)mmptr, sbuf.st_size, META_HEAPDUP);
+    for (me = mapcache; me < mapcache + MAPCACHE_SIZE; me++) {
+	if (!me->name) {
+	    if (!slot || slot->name)
+		slot = me;
+	} else if (!strcmp(me->name, name)) {
+	    if (mapent_matches(me, &sbuf)) {
+		close(fd);
+		me->used = ++mapcache_clock;
+		return me->val;
+	    }
+	    mapent_retire(me);
+	    slot = me;
+	} else if (!slot || (slot->name && me->used < slot->used))
+	    slot = me;
+    }
 
-    munmap(mmptr, sbuf.st_size);
+    if ((mmptr = (caddr_t)mmap((caddr_t)0, sbuf.st_size, PROT_READ,
+			       MMAP_ARGS, fd, (off_t)0)) == (caddr_t)-1) {
+	close(fd);
+	return NULL;
+    }
     close(fd);
+    if (sbuf.st_size > MAPCACHE_FILEMAX) {
+	val = metafy((char *)mmptr, sbuf.st_size, META_HEAPDUP);
+	munmap(mmptr, sbuf.st_size);
+	return val;
+    }
+    val = metafy((char *)mmptr, sbuf.st_size, META_DUP);
+    munmap(mmptr, sbuf.st_size);
+
+    /* Make room within MAPCACHE_BYTES, oldest first */
+    while (mapcache_bytes + sbuf.st_size > MAPCACHE_BYTES) {
+	struct mapent *old = NULL;
+
+	for (me = mapcache; me < mapcache + MAPCACHE_SIZE; me++)
+	    if (me->name && (!old || me->used < old->used))
+		old = me;
+	mapent_retire(old);
+    }
+    mapent_retire(slot);
+    slot->name = ztrdup(name);
+    slot->dev = sbuf.st_dev;
+    slot->ino = sbuf.st_ino;
+    slot->size = sbuf.st_size;
+    slot->mtime = sbuf.st_mtime;
+    slot->ctime = sbuf.st_ctime;
+#ifdef GET_ST_MTIME_NSEC
+    slot->mtime_nsec = GET_ST_MTIME_NSEC(sbuf);
+#endif
+#ifdef GET_ST_CTIME_NSEC
+    slot->ctime_nsec = GET_ST_CTIME_NSEC(sbuf);
+#endif
+    slot->val = val;
+    slot->used = ++mapcache_clock;
+    mapcache_bytes += sbuf.st_size;
 #else /* don't USE_MMAP */
     val = NULL;
     if ((fd = open(fname, O_RDONLY | O_NOCTTY)) >= 0) {
@@ -202,8 +336,8 @@ get_contents(char *fname)
 	if ((ll = readoutput(fd, 1, 0)))
 	    val = peekfirst(ll);
     }
-#endif /* USE_MMAP */
     free(fname);
+#endif /* USE_MMAP */
     return val;
 }
 
@@ -316,5 +450,14 @@ cleanup_(Module m)
 int
 finish_(UNUSED(Module m))
 {
+#ifdef USE_MMAP
+    int i;
+
+    for (i = 0; i < MAPCACHE_SIZE; i++)
+	mapent_release(mapcache + i);
+    for (i = 0; i < MAPCACHE_RETIRED; i++)
+	mapent_release(retired + i);
+    mapcache_bytes = 0;
+#endif
     return 0;
 }
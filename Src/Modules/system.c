@@ -36,6 +36,13 @@
 #if defined(HAVE_POLL) && !defined(POLLIN)
 # undef HAVE_POLL
 #endif
+#if defined(HAVE_WRITEV) && defined(HAVE_SYS_UIO_H)
+# include <sys/uio.h>
+# define USE_WRITEV 1
+# ifndef IOV_MAX
+#  define IOV_MAX 16
+# endif
+#endif
 
 #define SYSREAD_BUFSIZE	8192
 
@@ -56,6 +63,108 @@ getposint(char *instr, char *nam)
 }
 
 
+/*
+ * Partial lines left over by sysread -l, by input file descriptor.
+ * The device and inode are kept so that the tail of one file isn't
+ * prepended to the start of another when a descriptor is reused.
+ */
+struct sysline {
+    struct sysline *next;
+    int fd;
+    dev_t dev;
+    ino_t ino;
+    char *buf;			/* unmetafied */
+    int len;
+};
+
+static struct sysline *syslines;
+
+/**/
+static void
+freesysline(int fd)
+{
+    struct sysline *sl, **slp;
+
+    for (slp = &syslines; (sl = *slp); slp = &sl->next)
+	if (sl->fd == fd) {
+	    *slp = sl->next;
+	    zfree(sl->buf, sl->len);
+	    zfree(sl, sizeof(*sl));
+	    return;
+	}
+}
+
+/*
+ * Split the count bytes just read from fd into lines for sysread -l.
+ * The incomplete line at the end is kept for next time; at end of file
+ * it is returned on its own.
+ */
+
+/**/
+static int
+sysreadlines(int fd, char *inbuf, int count, char *outvar)
+{
+    struct sysline *sl;
+    struct stat st;
+    char **arr, **lp, *ptr, *end, *nl, *line;
+    int nlines = 0;
+
+    if (fstat(fd, &st))
+	memset(&st, 0, sizeof(st));
+    for (sl = syslines; sl; sl = sl->next)
+	if (sl->fd == fd)
+	    break;
+    if (sl && (sl->dev != st.st_dev || sl->ino != st.st_ino)) {
+	freesysline(fd);
+	sl = NULL;
+    }
+
+    if (!count) {
+	if (!sl) {
+	    setaparam(outvar, mkarray(NULL));
+	    return 5;
+	}
+	setaparam(outvar, mkarray(metafy(sl->buf, sl->len, META_DUP)));
+	freesysline(fd);
+	return 0;
+    }
+
+    end = inbuf + count;
+    for (ptr = inbuf; (nl = memchr(ptr, '\n', end - ptr)); ptr = nl + 1)
+	nlines++;
+    arr = lp = (char **) zalloc((nlines + 1) * sizeof(char *));
+    for (ptr = inbuf; (nl = memchr(ptr, '\n', end - ptr)); ptr = nl + 1) {
+	if (sl) {
+	    line = (char *) zalloc(sl->len + (nl - ptr) + 1);
+	    memcpy(line, sl->buf, sl->len);
+	    memcpy(line + sl->len, ptr, nl - ptr);
+	    *lp++ = metafy(line, sl->len + (nl - ptr), META_REALLOC);
+	    freesysline(fd);
+	    sl = NULL;
+	} else
+	    *lp++ = metafy(ptr, nl - ptr, META_DUP);
+    }
+    *lp = NULL;
+
+    if (ptr < end) {
+	if (!sl) {
+	    sl = (struct sysline *) zshcalloc(sizeof(*sl));
+	    sl->fd = fd;
+	    sl->dev = st.st_dev;
+	    sl->ino = st.st_ino;
+	    sl->next = syslines;
+	    syslines = sl;
+	}
+	sl->buf = zrealloc(sl->buf, sl->len + (end - ptr));
+	memcpy(sl->buf + sl->len, ptr, end - ptr);
+	sl->len += end - ptr;
+    }
+
+    setaparam(outvar, arr);
+    return 0;
+}
+
+
 /*
  * Return values of bin_sysread:
  *	0	Successfully read (and written if appropriate)
@@ -86,6 +195,10 @@ bin_sysread(char *nam, char **args, Options ops, UNUSED(int func))
 	    zwarnnam(nam, "no argument allowed with -o");
 	    return 1;
 	}
+	if (OPT_ISSET(ops, 'l')) {
+	    zwarnnam(nam, "-l can't be used with -o");
+	    return 1;
+	}
 	outfd = getposint(OPT_ARG(ops, 'o'), nam);
 	if (outfd < 0)
 	    return 1;
@@ -195,6 +308,10 @@ bin_sysread(char *nam, char **args, Options ops, UNUSED(int func))
     if (count < 0)
 	return 2;
 
+    /* -l: complete lines into an array, default reply */
+    if (OPT_ISSET(ops, 'l'))
+	return sysreadlines(infd, inbuf, count, outvar ? outvar : "reply");
+
     if (outfd >= 0) {
 	if (!count)
 	    return 5;
@@ -258,19 +375,57 @@ bin_syswrite(char *nam, char **args, Options ops, UNUSED(int func))
     }
 
     totcount = 0;
-    unmetafy(*args, &len);
-    while (len) {
-	while ((count = write(outfd, *args, len)) < 0) {
-	    if (errno != EINTR || errflag || retflag || breaks || contflag)
-	    {
-		if (countvar)
-		    setiparam(countvar, totcount);
-		return 2;
+#ifdef USE_WRITEV
+    if (args[1]) {
+	/* Several arguments: hand them to the system together */
+	int nargs = arrlen(args), i, n;
+	struct iovec *iov = (struct iovec *)
+	    zhalloc(nargs * sizeof(struct iovec));
+
+	for (i = 0; i < nargs; i++) {
+	    unmetafy(args[i], &len);
+	    iov[i].iov_base = args[i];
+	    iov[i].iov_len = len;
+	}
+	for (i = 0; i < nargs; ) {
+	    n = nargs - i > IOV_MAX ? IOV_MAX : nargs - i;
+	    while ((count = writev(outfd, iov + i, n)) < 0) {
+		if (errno != EINTR || errflag || retflag || breaks || contflag)
+		{
+		    if (countvar)
+			setiparam(countvar, totcount);
+		    return 2;
+		}
+	    }
+	    totcount += count;
+	    /* skip over what was written, which may end part way through */
+	    for (; i < nargs && (size_t)count >= iov[i].iov_len; i++)
+		count -= iov[i].iov_len;
+	    if (count) {
+		iov[i].iov_base = (char *)iov[i].iov_base + count;
+		iov[i].iov_len -= count;
+	    }
+	}
+	if (countvar)
+	    setiparam(countvar, totcount);
+	return 0;
+    }
+#endif
+    for (; *args; args++) {
+	unmetafy(*args, &len);
+	while (len) {
+	    while ((count = write(outfd, *args, len)) < 0) {
+		if (errno != EINTR || errflag || retflag || breaks || contflag)
+		{
+		    if (countvar)
+			setiparam(countvar, totcount);
+		    return 2;
+		}
 	    }
+	    *args += count;
+	    totcount += count;
+	    len -= count;
 	}
-	*args += count;
-	totcount += count;
-	len -= count;
     }
     if (countvar)
 	setiparam(countvar, totcount);
@@ -689,6 +844,165 @@ bin_zsystem_flock(char *nam, char **args, UNUSED(Options ops), UNUSED(int func))
 }
 
 
+/*
+ * Copy data between file descriptors without passing it through the
+ * shell: copy_file_range() between regular files, splice() if either
+ * is a pipe, else read() and write().  Return statuses:
+ *	0	Copied up to end of file or the requested count
+ *	1	Error in parameters to command
+ *	2	Error on read or write, ERRNO set by system
+ */
+
+#define ZCOPY_CHUNK (1024 * 1024)
+
+enum {
+    ZCOPY_RANGE,
+    ZCOPY_SPLICE,
+    ZCOPY_RDWR
+};
+
+/**/
+static int
+bin_zsystem_copy(char *nam, char **args, UNUSED(Options ops), UNUSED(int func))
+{
+    int infd, outfd, method = ZCOPY_RDWR;
+    zlong left = -1, total = 0;
+    ssize_t ret, chunk;
+    char *countvar = NULL, *buf = NULL;
+    struct stat ist, ost;
+
+    while (*args && **args == '-') {
+	char *optptr = *args + 1, *optarg;
+	args++;
+	if (!*optptr || !strcmp(optptr, "-"))
+	    break;
+	if (*optptr != 'c' && *optptr != 'n') {
+	    zwarnnam(nam, "copy: unknown option: %c", *optptr);
+	    return 1;
+	}
+	if (optptr[1])
+	    optarg = optptr + 1;
+	else if (*args)
+	    optarg = *args++;
+	else {
+	    zwarnnam(nam, "copy: option %c requires an argument", *optptr);
+	    return 1;
+	}
+	if (*optptr == 'c') {
+	    if (!isident(optarg)) {
+		zwarnnam(nam, "not an identifier: %s", optarg);
+		return 1;
+	    }
+	    countvar = optarg;
+	} else {
+	    left = mathevali(optarg);
+	    if (errflag)
+		return 1;
+	    if (left < 0) {
+		zwarnnam(nam, "copy: invalid count: %s", optarg);
+		return 1;
+	    }
+	}
+    }
+    if (!args[0] || !args[1]) {
+	zwarnnam(nam, "copy: not enough arguments");
+	return 1;
+    }
+    if (args[2]) {
+	zwarnnam(nam, "copy: too many arguments");
+	return 1;
+    }
+    if ((infd = getposint(args[0], nam)) < 0 ||
+	(outfd = getposint(args[1], nam)) < 0)
+	return 1;
+
+    if (fstat(infd, &ist) || fstat(outfd, &ost)) {
+	zwarnnam(nam, "copy: %e", errno);
+	return 1;
+    }
+#ifdef HAVE_COPY_FILE_RANGE
+    /* copy_file_range() refuses output opened for appending */
+    if (S_ISREG(ist.st_mode) && S_ISREG(ost.st_mode)
+# if defined(HAVE_FCNTL_H) && defined(O_APPEND)
+	&& !(fcntl(outfd, F_GETFL) & O_APPEND)
+# endif
+	)
+	method = ZCOPY_RANGE;
+#endif
+#ifdef HAVE_SPLICE
+    if (S_ISFIFO(ist.st_mode) || S_ISFIFO(ost.st_mode))
+	method = ZCOPY_SPLICE;
+#endif
+
+    while (left) {
+	chunk = (left < 0 || left > ZCOPY_CHUNK) ? ZCOPY_CHUNK : left;
+	switch (method) {
+#ifdef HAVE_COPY_FILE_RANGE
+	case ZCOPY_RANGE:
+	    ret = copy_file_range(infd, NULL, outfd, NULL, chunk, 0);
+	    break;
+#endif
+#ifdef HAVE_SPLICE
+	case ZCOPY_SPLICE:
+	    ret = splice(infd, NULL, outfd, NULL, chunk, SPLICE_F_MOVE);
+	    break;
+#endif
+	default:
+	    if (!buf)
+		buf = zhalloc(SYSREAD_BUFSIZE * 8);
+	    if (chunk > SYSREAD_BUFSIZE * 8)
+		chunk = SYSREAD_BUFSIZE * 8;
+	    if ((ret = read(infd, buf, chunk)) > 0) {
+		ssize_t done, wret;
+
+		for (done = 0; done < ret; done += wret) {
+		    while ((wret = write(outfd, buf + done, ret - done)) < 0) {
+			if (errno != EINTR || errflag || retflag ||
+			    breaks || contflag) {
+			    total += done;
+			    if (countvar)
+				setiparam(countvar, total);
+			    return 2;
+			}
+		    }
+		}
+	    }
+	    break;
+	}
+	if (ret < 0) {
+	    if (errno == EINTR && !errflag && !retflag && !breaks && !contflag)
+		continue;
+	    /*
+	     * Not supported between these descriptors after all,
+	     * e.g. files on different file systems: do it ourselves.
+	     * A genuinely bad descriptor is then reported by read()
+	     * or write().
+	     */
+	    if (method != ZCOPY_RDWR &&
+		(errno == EINVAL || errno == EXDEV || errno == ENOSYS ||
+		 errno == EBADF
+#ifdef EOPNOTSUPP
+		 || errno == EOPNOTSUPP
+#endif
+		    )) {
+		method = ZCOPY_RDWR;
+		continue;
+	    }
+	    if (countvar)
+		setiparam(countvar, total);
+	    return 2;
+	}
+	if (!ret)
+	    break;
+	total += ret;
+	if (left > 0)
+	    left -= ret;
+    }
+    if (countvar)
+	setiparam(countvar, total);
+    return 0;
+}
+
 /*
  * Return status zero if the zsystem feature is supported, else 1.
  * Operates silently for future-proofing.
@@ -708,7 +1022,7 @@ bin_zsystem_supports(char *nam, char **args,
     }
 
     /* stupid but logically this should work... */
-    if (!strcmp(*args, "supports"))
+    if (!strcmp(*args, "supports") || !strcmp(*args, "copy"))
 	return 0;
 #ifdef HAVE_FCNTL_H
     if (!strcmp(*args, "flock"))
@@ -727,6 +1041,8 @@ bin_zsystem(char *nam, char **args, Options ops, int func)
 	return bin_zsystem_flock(nam, args+1, ops, func);
     } else if (!strcmp(*args, "supports")) {
 	return bin_zsystem_supports(nam, args+1, ops, func);
+    } else if (!strcmp(*args, "copy")) {
+	return bin_zsystem_copy(nam, args+1, ops, func);
     }
     zwarnnam(nam, "unknown subcommand: %s", *args);
     return 1;
@@ -734,8 +1050,8 @@ bin_zsystem(char *nam, char **args, Options ops, int func)
 
 static struct builtin bintab[] = {
     BUILTIN("syserror", 0, bin_syserror, 0, 1, 0, "e:p:", NULL),
-    BUILTIN("sysread", 0, bin_sysread, 0, 1, 0, "c:i:o:s:t:", NULL),
-    BUILTIN("syswrite", 0, bin_syswrite, 1, 1, 0, "c:o:", NULL),
+    BUILTIN("sysread", 0, bin_sysread, 0, 1, 0, "c:i:lo:s:t:", NULL),
+    BUILTIN("syswrite", 0, bin_syswrite, 1, -1, 0, "c:o:", NULL),
     BUILTIN("sysopen", 0, bin_sysopen, 1, 1, 0, "rwau:o:m:", NULL),
     BUILTIN("sysseek", 0, bin_sysseek, 1, 1, 0, "u:w:", NULL),
     BUILTIN("zsystem", 0, bin_zsystem, 1, -1, 0, NULL, NULL)
@@ -873,5 +1189,7 @@ cleanup_(Module m)
 int
 finish_(UNUSED(Module m))
 {
+    while (syslines)
+	freesysline(syslines->fd);
     return 0;
 }
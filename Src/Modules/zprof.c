@@ -37,17 +37,34 @@ typedef struct pfunc *Pfunc;
 
 struct pfunc {
     Pfunc next;
+    Pfunc hnext;		/* next in hash chain */
     char *name;
     long calls;
     double time;
     double self;
     long num;
+    long forks;			/* processes forked while it was running */
+    long substs;		/* command substitutions run */
+    double stime;		/* time spent in command substitutions */
+};
+
+typedef struct ppath *Ppath;
+
+/* A call path: a function and the path it was called from. */
+
+struct ppath {
+    Ppath next;
+    Ppath hnext;		/* next in hash chain */
+    Ppath up;			/* caller's path, NULL at the top */
+    Pfunc f;
+    double self;
 };
 
 typedef struct sfunc *Sfunc;
 
 struct sfunc {
     Pfunc p;
+    Ppath path;
     Sfunc prev;
     double beg;
 };
@@ -56,6 +73,7 @@ typedef struct parc *Parc;
 
 struct parc {
     Parc next;
+    Parc hnext;			/* next in hash chain */
     Pfunc from;
     Pfunc to;
     long calls;
@@ -63,13 +81,64 @@ struct parc {
     double self;
 };
 
+typedef struct pcmd *Pcmd;
+
+/* Time spent in a builtin, a forked command or command substitutions. */
+
+struct pcmd {
+    Pcmd next;
+    Pcmd hnext;			/* next in hash chain */
+    int type;			/* EXST_* */
+    char *name;
+    long calls;
+    double time;
+};
+
 static Pfunc calls;
 static int ncalls;
 static Parc arcs;
 static int narcs;
+static Ppath paths;
+static int npaths;
+static Pcmd cmds;
+static int ncmds;
+static long nforks, nsubsts;
+static int cmdstats;
 static Sfunc stack;
 static Module zprof_module;
 
+/*
+ * Hash tables for finding functions by name, and arcs and call paths
+ * by the pair of pointers they connect.  The entries are also kept in
+ * the lists above; the tables are only used for lookup.  Each table
+ * grows when it has twice as many entries as chains.
+ */
+
+#define ZPROF_HMIN 64
+
+static Pfunc *pfunctab;
+static int pfunctabsz;
+static Parc *parctab;
+static int parctabsz;
+static Ppath *ppathtab;
+static int ppathtabsz;
+static Pcmd *pcmdtab;
+static int pcmdtabsz;
+
+#define hashptrs(A, B) \
+    ((unsigned) (((size_t) (A) >> 4) * 31 + ((size_t) (B) >> 4)))
+
+/* Get the current time in milliseconds. */
+
+static double
+zprof_time(void)
+{
+    struct timespec ts;
+
+    zmonotime(&ts);
+    return ((double) ts.tv_sec) * 1000.0 + ((double) ts.tv_nsec) / 1000000.0;
+}
+
 static void
 freepfuncs(Pfunc f)
 {
@@ -80,6 +149,9 @@ freepfuncs(Pfunc f)
 	zsfree(f->name);
 	zfree(f, sizeof(*f));
     }
+    zfree(pfunctab, pfunctabsz * sizeof(Pfunc));
+    pfunctab = NULL;
+    pfunctabsz = 0;
 }
 
 static void
@@ -91,6 +163,38 @@ freeparcs(Parc a)
 	n = a->next;
 	zfree(a, sizeof(*a));
     }
+    zfree(parctab, parctabsz * sizeof(Parc));
+    parctab = NULL;
+    parctabsz = 0;
+}
+
+static void
+freeppaths(Ppath p)
+{
+    Ppath n;
+
+    for (; p; p = n) {
+	n = p->next;
+	zfree(p, sizeof(*p));
+    }
+    zfree(ppathtab, ppathtabsz * sizeof(Ppath));
+    ppathtab = NULL;
+    ppathtabsz = 0;
+}
+
+static void
+freepcmds(Pcmd c)
+{
+    Pcmd n;
+
+    for (; c; c = n) {
+	n = c->next;
+	zsfree(c->name);
+	zfree(c, sizeof(*c));
+    }
+    zfree(pcmdtab, pcmdtabsz * sizeof(Pcmd));
+    pcmdtab = NULL;
+    pcmdtabsz = 0;
 }
 
 static Pfunc
@@ -98,25 +202,250 @@ findpfunc(char *name)
 {
     Pfunc f;
 
-    for (f = calls; f; f = f->next)
+    if (!pfunctab)
+	return NULL;
+    for (f = pfunctab[hasher(name) & (pfunctabsz - 1)]; f; f = f->hnext)
 	if (!strcmp(name, f->name))
 	    return f;
 
     return NULL;
 }
 
+static void
+addpfunc(Pfunc f)
+{
+    Pfunc *h;
+
+    f->next = calls;
+    calls = f;
+    if (++ncalls > pfunctabsz * 2) {
+	Pfunc g;
+
+	zfree(pfunctab, pfunctabsz * sizeof(Pfunc));
+	pfunctabsz = (pfunctabsz ? pfunctabsz * 4 : ZPROF_HMIN);
+	pfunctab = (Pfunc *) zshcalloc(pfunctabsz * sizeof(Pfunc));
+	for (g = calls; g; g = g->next) {
+	    h = pfunctab + (hasher(g->name) & (pfunctabsz - 1));
+	    g->hnext = *h;
+	    *h = g;
+	}
+    } else {
+	h = pfunctab + (hasher(f->name) & (pfunctabsz - 1));
+	f->hnext = *h;
+	*h = f;
+    }
+}
+
 static Parc
 findparc(Pfunc f, Pfunc t)
 {
     Parc a;
 
-    for (a = arcs; a; a = a->next)
+    if (!parctab)
+	return NULL;
+    for (a = parctab[hashptrs(f, t) & (parctabsz - 1)]; a; a = a->hnext)
 	if (a->from == f && a->to == t)
 	    return a;
 
     return NULL;
 }
 
+static void
+addparc(Parc a)
+{
+    Parc *h;
+
+    a->next = arcs;
+    arcs = a;
+    if (++narcs > parctabsz * 2) {
+	Parc b;
+
+	zfree(parctab, parctabsz * sizeof(Parc));
+	parctabsz = (parctabsz ? parctabsz * 4 : ZPROF_HMIN);
+	parctab = (Parc *) zshcalloc(parctabsz * sizeof(Parc));
+	for (b = arcs; b; b = b->next) {
+	    h = parctab + (hashptrs(b->from, b->to) & (parctabsz - 1));
+	    b->hnext = *h;
+	    *h = b;
+	}
+    } else {
+	h = parctab + (hashptrs(a->from, a->to) & (parctabsz - 1));
+	a->hnext = *h;
+	*h = a;
+    }
+}
+
+/* Find the call path for function f called from path up, adding it *
+ * if it's new.                                                      */
+
+static Ppath
+getppath(Ppath up, Pfunc f)
+{
+    Ppath p, *h;
+
+    if (ppathtab)
+	for (p = ppathtab[hashptrs(up, f) & (ppathtabsz - 1)]; p;
+	     p = p->hnext)
+	    if (p->up == up && p->f == f)
+		return p;
+
+    p = (Ppath) zalloc(sizeof(*p));
+    p->up = up;
+    p->f = f;
+    p->self = 0.0;
+    p->next = paths;
+    paths = p;
+    if (++npaths > ppathtabsz * 2) {
+	Ppath q;
+
+	zfree(ppathtab, ppathtabsz * sizeof(Ppath));
+	ppathtabsz = (ppathtabsz ? ppathtabsz * 4 : ZPROF_HMIN);
+	ppathtab = (Ppath *) zshcalloc(ppathtabsz * sizeof(Ppath));
+	for (q = paths; q; q = q->next) {
+	    h = ppathtab + (hashptrs(q->up, q->f) & (ppathtabsz - 1));
+	    q->hnext = *h;
+	    *h = q;
+	}
+    } else {
+	h = ppathtab + (hashptrs(up, f) & (ppathtabsz - 1));
+	p->hnext = *h;
+	*h = p;
+    }
+    return p;
+}
+
+/* Find the entry for a command of the given type, adding it if it's new. */
+
+static Pcmd
+getpcmd(int type, char *name)
+{
+    Pcmd c, *h;
+
+    if (pcmdtab)
+	for (c = pcmdtab[(hasher(name) + type) & (pcmdtabsz - 1)]; c;
+	     c = c->hnext)
+	    if (c->type == type && !strcmp(name, c->name))
+		return c;
+
+    c = (Pcmd) zalloc(sizeof(*c));
+    c->type = type;
+    c->name = ztrdup(name);
+    c->calls = 0;
+    c->time = 0.0;
+    c->next = cmds;
+    cmds = c;
+    if (++ncmds > pcmdtabsz * 2) {
+	Pcmd d;
+
+	zfree(pcmdtab, pcmdtabsz * sizeof(Pcmd));
+	pcmdtabsz = (pcmdtabsz ? pcmdtabsz * 4 : ZPROF_HMIN);
+	pcmdtab = (Pcmd *) zshcalloc(pcmdtabsz * sizeof(Pcmd));
+	for (d = cmds; d; d = d->next) {
+	    h = pcmdtab + ((hasher(d->name) + d->type) & (pcmdtabsz - 1));
+	    d->hnext = *h;
+	    *h = d;
+	}
+    } else {
+	h = pcmdtab + ((hasher(name) + type) & (pcmdtabsz - 1));
+	c->hnext = *h;
+	*h = c;
+    }
+    return c;
+}
+
+/*
+ * Function for the exec_stats hook, installed by `zprof -e'.  Forked
+ * commands are named by the first word of the job text that isn't an
+ * assignment.
+ */
+
+static int
+zprof_execstats(UNUSED(Hookdef d), void *data)
+{
+    struct execstats *es = (struct execstats *) data;
+    Pcmd c;
+    char *name = es->name, *p;
+
+    if (!zprof_module || (zprof_module->node.flags & MOD_UNLOAD))
+	return 0;
+    switch (es->type) {
+    case EXST_FORK:
+	nforks++;
+	if (stack)
+	    stack->p->forks++;
+	return 0;
+
+    case EXST_SUBST:
+	nsubsts++;
+	if (stack) {
+	    stack->p->substs++;
+	    stack->p->stime += es->time * 1000.0;
+	}
+	name = "$(...)";
+	break;
+
+    case EXST_FORKED:
+	if (!name)
+	    return 0;
+	for (;;) {
+	    while (inblank(*name))
+		name++;
+	    for (p = name; *p && !inblank(*p) && *p != '='; p++);
+	    if (*p != '=' || p == name)
+		break;
+	    for (; *p && !inblank(*p); p++);
+	    if (!*p)
+		break;
+	    name = p;
+	}
+	for (p = name; *p && !inblank(*p); p++);
+	name = dupstrpfx(name, p - name);
+	break;
+    }
+    if (!name || !*name)
+	return 0;
+    c = getpcmd(es->type, name);
+    c->calls++;
+    c->time += es->time * 1000.0;
+
+    return 0;
+}
+
+/* Print the call paths in the "folded" format used by flame graph *
+ * tools:  function names separated by semicolons and the time spent *
+ * in the last one, in microseconds.                                 */
+
+static void
+printppaths(void)
+{
+    char **folded = (char **) zhalloc((npaths + 1) * sizeof(char *));
+    Ppath p, q;
+    char *line, *lp;
+    int i, len;
+
+    for (i = 0, p = paths; p; p = p->next, i++) {
+	for (len = 0, q = p; q; q = q->up)
+	    len += strlen(q->f->name) + 1;
+	line = (char *) zhalloc(len + 32);
+	sprintf(line + len - 1, " %.0f", p->self * 1000.0);
+	for (lp = line + len - 1, q = p; q; q = q->up) {
+	    int l = strlen(q->f->name);
+
+	    lp -= l;
+	    memcpy(lp, q->f->name, l);
+	    if (q->up)
+		*--lp = ';';
+	}
+	folded[i] = line;
+    }
+    folded[i] = NULL;
+    strmetasort(folded, SORTIT_ANYOLDHOW, NULL);
+    for (i = 0; folded[i]; i++) {
+	zputs(folded[i], stdout);
+	putchar('\n');
+    }
+}
+
 static int
 cmpsfuncs(Pfunc *a, Pfunc *b)
 {
@@ -135,16 +464,77 @@ cmpparcs(Parc *a, Parc *b)
     return ((*a)->time > (*b)->time ? -1 : ((*a)->time != (*b)->time));
 }
 
+static int
+cmppcmds(Pcmd *a, Pcmd *b)
+{
+    return ((*a)->time > (*b)->time ? -1 : ((*a)->time != (*b)->time));
+}
+
+/* Print the times for builtins, forked commands and command *
+ * substitutions, and the forks done by each function.       */
+
+static void
+printpcmds(Pfunc *fs)
+{
+    VARARR(Pcmd, cs, (ncmds + 1));
+    Pcmd c, *cp;
+    Pfunc *fp;
+    long i;
+
+    for (c = cmds, cp = cs; c; c = c->next, cp++)
+	*cp = c;
+    *cp = NULL;
+    qsort(cs, ncmds, sizeof(c),
+	  (int (*) _((const void *, const void *))) cmppcmds);
+
+    printf("\n-----------------------------------------------------------------------------------\n\n");
+    printf("num  calls                time            type      name\n-----------------------------------------------------------------------------------\n");
+    for (cp = cs, i = 1; *cp; cp++, i++)
+	printf("%2ld) %4ld       %8.2f %8.2f       %-9s %s\n",
+	       i, (*cp)->calls, (*cp)->time,
+	       (*cp)->time / ((double) (*cp)->calls),
+	       ((*cp)->type == EXST_BUILTIN ? "builtin" :
+		(*cp)->type == EXST_SUBST ? "subst" : "forked"),
+	       (*cp)->name);
+
+    printf("\n-----------------------------------------------------------------------------------\n\n");
+    printf("forks  substs     subst time            name\n-----------------------------------------------------------------------------------\n");
+    for (fp = fs; *fp; fp++)
+	if ((*fp)->forks || (*fp)->substs)
+	    printf("%5ld  %6ld       %8.2f             %s [%ld]\n",
+		   (*fp)->forks, (*fp)->substs, (*fp)->stime,
+		   (*fp)->name, (*fp)->num);
+    printf("%5ld  %6ld                            (total)\n",
+	   nforks, nsubsts);
+}
+
 static int
 bin_zprof(UNUSED(char *nam), UNUSED(char **args), Options ops, UNUSED(int func))
 {
-    if (OPT_ISSET(ops,'c')) {
+    if (OPT_MINUS(ops,'e')) {
+	if (!cmdstats)
+	    addhookfunc("exec_stats", zprof_execstats);
+	cmdstats = 1;
+    } else if (OPT_PLUS(ops,'e')) {
+	if (cmdstats)
+	    deletehookfunc("exec_stats", zprof_execstats);
+	cmdstats = 0;
+    } else if (OPT_ISSET(ops,'c')) {
 	freepfuncs(calls);
 	calls = NULL;
 	ncalls = 0;
 	freeparcs(arcs);
 	arcs = NULL;
 	narcs = 0;
+	freeppaths(paths);
+	paths = NULL;
+	npaths = 0;
+	freepcmds(cmds);
+	cmds = NULL;
+	ncmds = 0;
+	nforks = nsubsts = 0;
+    } else if (OPT_ISSET(ops,'f')) {
+	printppaths();
     } else {
 	VARARR(Pfunc, fs, (ncalls + 1));
 	Pfunc f, *fp;
@@ -209,6 +599,8 @@ bin_zprof(UNUSED(char *nam), UNUSED(char **args), Options ops, UNUSED(int func))
 			   (*ap)->to->name, (*ap)->to->num);
 		}
 	}
+	if (cmdstats || cmds)
+	    printpcmds(fs);
     }
     return 0;
 }
@@ -221,8 +613,6 @@ zprof_wrapper(Eprog prog, FuncWrap w, char *name)
     struct sfunc sf, *sp;
     Pfunc f = NULL;
     Parc a = NULL;
-    struct timeval tv;
-    struct timezone dummy;
     double prev = 0, now;
 
     if (zprof_module && !(zprof_module->node.flags & MOD_UNLOAD)) {
@@ -231,10 +621,9 @@ zprof_wrapper(Eprog prog, FuncWrap w, char *name)
             f = (Pfunc) zalloc(sizeof(*f));
             f->name = ztrdup(name);
             f->calls = 0;
-            f->time = f->self = 0.0;
-            f->next = calls;
-            calls = f;
-            ncalls++;
+            f->time = f->self = f->stime = 0.0;
+            f->forks = f->substs = 0;
+            addpfunc(f);
         }
         if (stack) {
             if (!(a = findparc(stack->p, f))) {
@@ -243,30 +632,23 @@ zprof_wrapper(Eprog prog, FuncWrap w, char *name)
                 a->to = f;
                 a->calls = 0;
                 a->time = a->self = 0.0;
-                a->next = arcs;
-                arcs = a;
-                narcs++;
+                addparc(a);
             }
         }
         sf.prev = stack;
         sf.p = f;
+        sf.path = getppath(stack ? stack->path : NULL, f);
         stack = &sf;
 
         f->calls++;
-        tv.tv_sec = tv.tv_usec = 0;
-        gettimeofday(&tv, &dummy);
-        sf.beg = prev = ((((double) tv.tv_sec) * 1000.0) +
-                         (((double) tv.tv_usec) / 1000.0));
+        sf.beg = prev = zprof_time();
     }
     runshfunc(prog, w, name);
     if (active) {
         if (zprof_module && !(zprof_module->node.flags & MOD_UNLOAD)) {
-            tv.tv_sec = tv.tv_usec = 0;
-            gettimeofday(&tv, &dummy);
-
-            now = ((((double) tv.tv_sec) * 1000.0) +
-                   (((double) tv.tv_usec) / 1000.0));
+            now = zprof_time();
             f->self += now - sf.beg;
+            sf.path->self += now - sf.beg;
             for (sp = sf.prev; sp && sp->p != f; sp = sp->prev);
             if (!sp)
                 f->time += now - prev;
@@ -288,7 +670,7 @@ zprof_wrapper(Eprog prog, FuncWrap w, char *name)
 }
 
 static struct builtin bintab[] = {
-    BUILTIN("zprof", 0, bin_zprof, 0, 0, 0, "c", NULL),
+    BUILTIN("zprof", BINF_PLUSOPTS, bin_zprof, 0, 0, 0, "cef", NULL),
 };
 
 static struct funcwrap wrapper[] = {
@@ -334,6 +716,12 @@ boot_(Module m)
     ncalls = 0;
     arcs = NULL;
     narcs = 0;
+    paths = NULL;
+    npaths = 0;
+    cmds = NULL;
+    ncmds = 0;
+    nforks = nsubsts = 0;
+    cmdstats = 0;
     stack = NULL;
     return addwrapper(m, wrapper);
 }
@@ -344,6 +732,10 @@ cleanup_(Module m)
 {
     freepfuncs(calls);
     freeparcs(arcs);
+    freeppaths(paths);
+    freepcmds(cmds);
+    if (cmdstats)
+	deletehookfunc("exec_stats", zprof_execstats);
     deletewrapper(m, wrapper);
     return setfeatureenables(m, &module_features, NULL);
 }
@@ -30,12 +30,23 @@
 #include "zpty.mdh"
 #include "zpty.pro"
 
+#ifdef HAVE_POLL_H
+# include <poll.h>
+#endif
+#if defined(HAVE_POLL) && !defined(POLLIN)
+# undef HAVE_POLL
+#endif
+
 /* The number of bytes we normally read when given no pattern and the
  * upper bound on the number of bytes we read (even if we are give a
  * pattern). */
 
 #define READ_MAX (1024 * 1024)
 
+/* The size of the buffer for output read from the pty but not yet used. */
+
+#define PTY_BUFSIZE 8192
+
 typedef struct ptycmd *Ptycmd;
 
 struct ptycmd {
@@ -47,7 +58,8 @@ struct ptycmd {
     int echo;
     int nblock;
     int fin;
-    int read;
+    char *rbuf;			/* output read but not used yet ... */
+    int rpos, rlen;		/* ... at rbuf + rpos, rlen bytes */
     char *old;
     int olen;
 };
@@ -445,7 +457,8 @@ newptycmd(char *nam, char *pname, char **args, int echo, int nblock)
     p->echo = echo;
     p->nblock = nblock;
     p->fin = 0;
-    p->read = -1;
+    p->rbuf = NULL;
+    p->rpos = p->rlen = 0;
     p->old = NULL;
     p->olen = 0;
 
@@ -492,6 +505,10 @@ deleteptycmd(Ptycmd cmd)
 
     zsfree(p->name);
     freearray(p->args);
+    if (p->rbuf)
+	zfree(p->rbuf, PTY_BUFSIZE);
+    if (p->old)
+	zfree(p->old, p->olen);
 
     zclose(cmd->fd);
 
@@ -513,32 +530,155 @@ deleteallptycmds(void)
     }
 }
 
+/*
+ * Read a block of output from the pty into the command's buffer,
+ * which must be empty.  Returns the result of read().
+ */
+
+static int
+ptyfill(Ptycmd cmd)
+{
+    int r;
+
+    if (!cmd->rbuf)
+	cmd->rbuf = (char *) zalloc(PTY_BUFSIZE);
+    cmd->rpos = 0;
+    if ((r = read(cmd->fd, cmd->rbuf, PTY_BUFSIZE)) > 0)
+	cmd->rlen = r;
+    return r;
+}
+
 /**** a better process handling would be nice */
 
 static void
 checkptycmd(Ptycmd cmd)
 {
-    char c;
-    int r;
-
-    if (cmd->read != -1 || cmd->fin)
+    if (cmd->rlen || cmd->fin)
 	return;
-    if ((r = read(cmd->fd, &c, 1)) <= 0) {
+    if (ptyfill(cmd) <= 0) {
 	if (kill(cmd->pid, 0) < 0) {
 	    cmd->fin = 1;
 	    zclose(cmd->fd);
 	}
-	return;
     }
-    cmd->read = (int) c;
 }
 
+/*
+ * Wait up to timeout milliseconds for output from the pty.
+ * Return 1 if there is some, either buffered or to be read.
+ */
+
 static int
-ptyread(char *nam, Ptycmd cmd, char **args, int noblock, int mustmatch)
+ptypoll(Ptycmd cmd, int timeout)
 {
-    int blen, used, seen = 0, ret = 0, matchok = 0;
+    int pollret = -1;
+
+    if (cmd->rlen)
+	return 1;
+    {
+#ifdef HAVE_POLL
+	struct pollfd pfd;
+
+	pfd.fd = cmd->fd;
+	pfd.events = POLLIN;
+	pollret = poll(&pfd, 1, timeout);
+#else
+#ifdef HAVE_SELECT
+	fd_set foofd;
+	struct timeval expire_tv;
+
+	expire_tv.tv_sec = timeout / 1000;
+	expire_tv.tv_usec = (timeout % 1000) * 1000L;
+	FD_ZERO(&foofd);
+	FD_SET(cmd->fd, &foofd);
+	pollret = select(cmd->fd+1,
+			 (SELECT_ARG_2_T) &foofd, NULL, NULL, &expire_tv);
+#else
+#ifdef FIONREAD
+	int val;
+
+	if (ioctl(cmd->fd, FIONREAD, (char *) &val) == 0)
+	    pollret = (val > 0);
+#endif
+#endif
+#endif
+    }
+    if (pollret < 0) {
+	/*
+	 * See read_poll() for this.
+	 * Last despairing effort to poll: attempt to
+	 * set nonblocking I/O and actually read some
+	 * output into the buffer.
+	 */
+	long mode;
+
+	pollret = 0;
+	if (setblock_fd(0, cmd->fd, &mode))
+	    pollret = (ptyfill(cmd) > 0);
+	if (mode != -1)
+	    fcntl(cmd->fd, F_SETFL, mode);
+    }
+    return pollret > 0;
+}
+
+/* Test the prefix of buf of the given length against a pattern. */
+
+static int
+ptytryprefix(Patprog prog, char *buf, int len)
+{
+    char save = buf[len];
+    int ret;
+
+    buf[len] = '\0';
+    ret = pattry(prog, buf);
+    buf[len] = save;
+    return ret;
+}
+
+/*
+ * Find the shortest prefix of the metafied buf, longer than from
+ * bytes, that matches prog.  The prefixes of buf up to from bytes
+ * are known not to match.  anyprog is the pattern followed by `*',
+ * which matches if any prefix does; if it matches a prefix of buf,
+ * it matches any longer prefix, so the shortest can be found by
+ * bisection with a handful of tests rather than testing each
+ * prefix in turn.  Returns the length of the prefix, or -1.
+ */
+
+static int
+ptymatch(Patprog prog, Patprog anyprog, char *buf, int from, int used)
+{
+    int lo = from, hi = used, mid;
+
+    if (!anyprog) {
+	for (mid = from + 1; mid <= used; mid++)
+	    if (buf[mid - 1] != Meta && ptytryprefix(prog, buf, mid))
+		return mid;
+	return -1;
+    }
+    if (!pattry(anyprog, buf))
+	return -1;
+    /* lo doesn't match, hi does; both are character boundaries */
+    while (hi - lo > 1) {
+	mid = lo + (hi - lo) / 2;
+	if (buf[mid - 1] == Meta && ++mid == hi)
+	    break;
+	if (ptytryprefix(anyprog, buf, mid))
+	    hi = mid;
+	else
+	    lo = mid;
+    }
+    return hi;
+}
+
+static int
+ptyread(char *nam, Ptycmd cmd, char **args, int noblock, int timeout,
+	int mustmatch)
+{
+    int blen, used, seen = 0, ret = 0, matchok = 0, tested = 0;
     char *buf;
-    Patprog prog = NULL;
+    Patprog prog = NULL, anyprog = NULL;
+    zlong deadline = 0;
 
     if (*args && args[1]) {
 	char *p;
@@ -555,6 +695,13 @@ ptyread(char *nam, Ptycmd cmd, char **args, int noblock, int mustmatch)
 	    zwarnnam(nam, "bad pattern: %s", args[1]);
 	    return 1;
 	}
+	/* This doesn't work if the pattern has to match at the end. */
+	if (!strstr(args[1], "(#e)")) {
+	    p = zhtricat("(", args[1], ")*");
+	    tokenize(p);
+	    remnulargs(p);
+	    anyprog = patcompile(p, PAT_ZDUP, NULL);
+	}
     } else
 	fflush(stdout);
 
@@ -565,88 +712,98 @@ ptyread(char *nam, Ptycmd cmd, char **args, int noblock, int mustmatch)
 	zfree(cmd->old, cmd->olen);
 	cmd->old = NULL;
 	cmd->olen = 0;
+	/* already tested by the read that saved it */
+	tested = used;
     } else {
 	used = 0;
 	buf = (char *) zhalloc((blen = 256) + 1);
     }
-    if (cmd->read != -1) {
-	buf[used] = (char) cmd->read;
-	buf[used + 1] = '\0';
-	seen = used = 1;
-	cmd->read = -1;
+    buf[used] = '\0';
+    if (noblock && timeout > 0) {
+	struct timespec ts;
+
+	zmonotime(&ts);
+	deadline = (zlong) ts.tv_sec * 1000 + ts.tv_nsec / 1000000 + timeout;
     }
     do {
-	if (noblock && cmd->read == -1) {
-	    int pollret;
-	    /*
-	     * Check there is data available.  Borrowed from
-	     * poll_read() in utils.c and simplified.
-	     */
-#ifdef HAVE_SELECT
-	    fd_set foofd;
-	    struct timeval expire_tv;
-	    expire_tv.tv_sec = 0;
-	    expire_tv.tv_usec = 0;
-	    FD_ZERO(&foofd);
-	    FD_SET(cmd->fd, &foofd);
-	    pollret = select(cmd->fd+1,
-			 (SELECT_ARG_2_T) &foofd, NULL, NULL, &expire_tv);
-#else
-#ifdef FIONREAD
-	    if (ioctl(cmd->fd, FIONREAD, (char *) &val) == 0)
-		pollret = (val > 0);
-#endif
-#endif
-
-	    if (pollret < 0) {
-		/*
-		 * See read_poll() for this.
-		 * Last despairing effort to poll: attempt to
-		 * set nonblocking I/O and actually read the
-		 * character.  cmd->read stores the character read.
-		 */
-		long mode;
-
-		if (setblock_fd(0, cmd->fd, &mode))
-		    pollret = read(cmd->fd, &cmd->read, 1);
-		if (mode != -1)
-		    fcntl(cmd->fd, F_SETFL, mode);
+	if (!cmd->rlen) {
+	    if (noblock) {
+		int wait = 0;
+
+		if (deadline) {
+		    struct timespec ts;
+		    zlong now;
+
+		    zmonotime(&ts);
+		    now = (zlong) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+		    if (now < deadline)
+			wait = (int) (deadline - now);
+		}
+		if (!ptypoll(cmd, wait))
+		    break;
+	    }
+	    if (!ret) {
+		checkptycmd(cmd);
+		if (cmd->fin)
+		    break;
 	    }
-	    if (pollret == 0)
-		break;
-	}
-	if (!ret) {
-	    checkptycmd(cmd);
-	    if (cmd->fin)
-		break;
 	}
-	if (cmd->read != -1 || (ret = read(cmd->fd, buf + used, 1)) == 1) {
-	    int readchar;
-	    if (cmd->read != -1) {
-		ret = 1;
-		readchar = cmd->read;
-		cmd->read = -1;
-	    } else
-		readchar = STOUC(buf[used]);
-	    if (imeta(readchar)) {
-		buf[used++] = Meta;
-		buf[used++] = (char) (readchar ^ 32);
-	    } else
-		buf[used++] = (char) readchar;
+	if (cmd->rlen || (ret = ptyfill(cmd)) > 0) {
+	    char *s = cmd->rbuf + cmd->rpos, *e = s + cmd->rlen, *nl;
+	    int start = used;
+
+	    ret = 1;
 	    seen = 1;
-	    if (used >= blen-1) {
-		if (!*args) {
-		    buf[used] = '\0';
-		    unmetafy(buf, &used);
-		    write_loop(1, buf, used);
-		    used = 0;
-		} else {
-		    buf = hrealloc(buf, blen, blen << 1);
-		    blen <<= 1;
+	    if (!*args) {
+		/* Just copying to stdout, no need to keep it. */
+		write_loop(1, s, cmd->rlen);
+		cmd->rlen = 0;
+	    } else {
+		if (!prog && (nl = memchr(s, '\n', cmd->rlen)))
+		    e = nl + 1;
+		if (e - s > READ_MAX - used)
+		    e = s + (READ_MAX - used > 0 ? READ_MAX - used : 1);
+		if (used + 2 * (e - s) >= blen) {
+		    int nlen = blen;
+
+		    while (used + 2 * (e - s) >= nlen)
+			nlen <<= 1;
+		    buf = hrealloc(buf, blen + 1, nlen + 1);
+		    blen = nlen;
+		}
+		cmd->rpos += e - s;
+		cmd->rlen -= e - s;
+		for (; s < e; s++) {
+		    if (imeta(STOUC(*s))) {
+			buf[used++] = Meta;
+			buf[used++] = *s ^ 32;
+		    } else
+			buf[used++] = *s;
+		}
+		buf[used] = '\0';
+		if (prog) {
+		    int len = ptymatch(prog, anyprog, buf, tested, used);
+
+		    if (len >= 0) {
+			/*
+			 * Put back what came after the match for the
+			 * next read; what was taken from the buffer in
+			 * this pass is still there.
+			 */
+			for (s = buf + (len > start ? len : start);
+			     s < buf + used; s++) {
+			    if (*s == Meta)
+				s++;
+			    cmd->rpos--;
+			    cmd->rlen++;
+			}
+			buf[used = len] = '\0';
+			matchok = 1;
+		    } else
+			tested = used;
 		}
 	    }
 	}
-	buf[used] = '\0';
 
 	if (!prog) {
 	    if (ret <= 0 || (*args && buf[used - 1] == '\n' &&
@@ -665,8 +822,7 @@ ptyread(char *nam, Ptycmd cmd, char **args, int noblock, int mustmatch)
 		break;
 	}
     } while (!(errflag || breaks || retflag || contflag) &&
-	     used < READ_MAX &&
-	     !(prog && ret && (matchok = pattry(prog, buf))));
+	     used < READ_MAX && !matchok);
 
     if (prog && ret < 0 &&
 #ifdef EWOULDBLOCK
@@ -680,14 +836,13 @@ ptyread(char *nam, Ptycmd cmd, char **args, int noblock, int mustmatch)
 	cmd->old = (char *) zalloc(cmd->olen = used);
 	memcpy(cmd->old, buf, cmd->olen);
 
+	freepatprog(prog);
+	if (anyprog)
+	    freepatprog(anyprog);
 	return 1;
     }
     if (*args)
 	setsparam(*args, ztrdup(buf));
-    else if (used) {
-	unmetafy(buf, &used);
-	write_loop(1, buf, used);
-    }
 
     {
 	int ret = cmd->fin + 1;
@@ -695,6 +850,8 @@ ptyread(char *nam, Ptycmd cmd, char **args, int noblock, int mustmatch)
 	    ret = 0;
 	if (prog)
 	    freepatprog(prog);
+	if (anyprog)
+	    freepatprog(anyprog);
 	return ret;
     }
 }
@@ -793,6 +950,8 @@ bin_zpty(char *nam, char **args, Options ops, UNUSED(int func))
 
 	return (OPT_ISSET(ops,'r') ?
 		ptyread(nam, p, args + 1, OPT_ISSET(ops,'t'),
+			(OPT_HASARG(ops,'t') ?
+			 (int) zstrtol(OPT_ARG(ops,'t'), NULL, 10) * 10 : 0),
 			OPT_ISSET(ops, 'm')) :
 		ptywrite(p, args + 1, OPT_ISSET(ops,'n')));
     } else if (OPT_ISSET(ops,'d')) {
@@ -868,7 +1027,7 @@ ptyhook(UNUSED(Hookdef d), UNUSED(void *dummy))
 
 
 static struct builtin bintab[] = {
-    BUILTIN("zpty", 0, bin_zpty, 0, -1, 0, "ebdmrwLnt", NULL),
+    BUILTIN("zpty", 0, bin_zpty, 0, -1, 0, "ebdmrwLnt:%", NULL),
 };
 
 static struct features module_features = {
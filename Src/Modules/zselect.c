@@ -30,14 +30,438 @@
 #include "zselect.mdh"
 #include "zselect.pro"
 
-/* Helper functions */
+#ifdef HAVE_POLL_H
+# include <poll.h>
+#endif
+#if defined(HAVE_POLL) && !defined(POLLIN)
+# undef HAVE_POLL
+#endif
+
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_EPOLL_CREATE1) && \
+    defined(HAVE_POLL)
+# include <sys/epoll.h>
+# define ZSELECT_EPOLL
+#endif
+
+/* Index of the conditions in fd lists; ZSEL_DEL removes fds from a watcher */
+
+enum {
+    ZSEL_READ,
+    ZSEL_WRITE,
+    ZSEL_ERROR,
+    ZSEL_DEL
+};
+
+static const char fdchar[3] = "rwe";
+
+/* File descriptors given on the command line, with their condition. */
+
+struct zselarg {
+    int fd;
+    int ind;
+};
+
+struct zselargs {
+    struct zselarg *a;
+    int n, sz;
+};
+
+#ifdef HAVE_POLL
+
+/*
+ * A named watcher:  a set of file descriptors kept between calls
+ * so that waiting doesn't need to go through the whole set.  With
+ * epoll, file descriptors are registered with the kernel when they
+ * are added, so the work on each wakeup is proportional to the number
+ * of descriptors that are ready.  Otherwise the pollfd array is kept
+ * ready to pass to poll().  Either way there is no limit on the
+ * descriptor numbers as there is with select().
+ */
+
+typedef struct zselwatch *Zselwatch;
+
+struct zselwatch {
+    Zselwatch next;
+    char *name;
+    struct pollfd *fds;		/* descriptors and conditions watched */
+    int nfds, fdssz;
+    int *fdidx;			/* index in fds plus one, by descriptor */
+    int fdidxsz;
+#ifdef ZSELECT_EPOLL
+    int epfd;			/* epoll descriptor, -1 if not yet created */
+    pid_t pid;			/* process that created it */
+    char *always;		/* by index: epoll refused it, always ready */
+    int nalways;
+    struct epoll_event *evs;	/* buffer for epoll_wait() */
+    int evssz;
+#endif
+};
+
+static Zselwatch zselwatches;
+
+/*
+ * Bit mask of ZSEL_* conditions for poll() events.  As with select(),
+ * end of file or an error counts as ready for reading.
+ */
+
+#define ZSEL_RMASK(ev) \
+    ((((ev) & (POLLIN|POLLHUP|POLLERR)) ? (1 << ZSEL_READ) : 0) | \
+     (((ev) & (POLLOUT|POLLERR)) ? (1 << ZSEL_WRITE) : 0) | \
+     (((ev) & POLLPRI) ? (1 << ZSEL_ERROR) : 0))
+
+static Zselwatch
+findzselwatch(char *name)
+{
+    Zselwatch w;
+
+    for (w = zselwatches; w; w = w->next)
+	if (!strcmp(w->name, name))
+	    return w;
+    return NULL;
+}
+
+static void
+freezselwatch(Zselwatch w)
+{
+    zsfree(w->name);
+    zfree(w->fds, w->fdssz * sizeof(*w->fds));
+    zfree(w->fdidx, w->fdidxsz * sizeof(int));
+#ifdef ZSELECT_EPOLL
+    if (w->epfd >= 0 && w->pid == getpid())
+	zclose(w->epfd);
+    zfree(w->always, w->fdssz);
+    zfree(w->evs, w->evssz * sizeof(*w->evs));
+#endif
+    zfree(w, sizeof(*w));
+}
+
+static void
+deletezselwatch(Zselwatch w)
+{
+    Zselwatch *wp;
+
+    for (wp = &zselwatches; *wp != w; wp = &(*wp)->next)
+	;
+    *wp = w->next;
+    freezselwatch(w);
+}
+
+static int
+zselwatchidx(Zselwatch w, int fd)
+{
+    return (fd < w->fdidxsz ? w->fdidx[fd] - 1 : -1);
+}
+
+#ifdef ZSELECT_EPOLL
+
+static int
+zselepollevents(int events)
+{
+    return (((events & POLLIN) ? EPOLLIN : 0) |
+	    ((events & POLLOUT) ? EPOLLOUT : 0) |
+	    ((events & POLLPRI) ? EPOLLPRI : 0));
+}
 
 /*
- * Handle an fd by adding it to the current fd_set.
+ * Tell epoll about a descriptor that has been added to the watcher
+ * (op EPOLL_CTL_ADD) or changed (EPOLL_CTL_MOD).  Descriptors epoll
+ * can't handle, such as regular files, are always ready, as with
+ * select().  Return 1 for error (after printing a message), 0 for OK.
+ */
+
+static int
+zselepollctl(char *nam, Zselwatch w, int i, int op)
+{
+    struct epoll_event ev;
+
+    if (w->always[i])
+	return 0;
+    ev.events = zselepollevents(w->fds[i].events);
+    ev.data.fd = w->fds[i].fd;
+    if (epoll_ctl(w->epfd, op, w->fds[i].fd, &ev) == 0)
+	return 0;
+    if (errno == EPERM) {
+	w->always[i] = 1;
+	w->nalways++;
+	return 0;
+    }
+    zwarnnam(nam, "can't watch file descriptor %d: %e", w->fds[i].fd, errno);
+    return 1;
+}
+
+/*
+ * Make sure the watcher has an epoll descriptor of its own.  A
+ * subshell shares the parent's, so it gets a new one with the same
+ * descriptors registered.
+ */
+
+static int
+zselepollfd(char *nam, Zselwatch w)
+{
+    int i;
+
+    if (w->epfd >= 0 && w->pid == getpid())
+	return 0;
+    if ((w->epfd = movefd(epoll_create1(EPOLL_CLOEXEC))) < 0) {
+	zwarnnam(nam, "can't create epoll descriptor: %e", errno);
+	return 1;
+    }
+    w->pid = getpid();
+    memset(w->always, 0, w->fdssz);
+    w->nalways = 0;
+    for (i = 0; i < w->nfds; i++)
+	if (zselepollctl(nam, w, i, EPOLL_CTL_ADD))
+	    return 1;
+    return 0;
+}
+
+#endif /* ZSELECT_EPOLL */
+
+/* Remove the descriptor at index i from a watcher. */
+
+static void
+zselwatchdel(Zselwatch w, int i)
+{
+    int fd = w->fds[i].fd, last = w->nfds - 1;
+
+#ifdef ZSELECT_EPOLL
+    if (w->always[i])
+	w->nalways--;
+    else if (w->epfd >= 0 && w->pid == getpid())
+	epoll_ctl(w->epfd, EPOLL_CTL_DEL, fd, NULL);
+    w->always[i] = w->always[last];
+    w->always[last] = 0;
+#endif
+    w->fdidx[fd] = 0;
+    if (i != last) {
+	w->fds[i] = w->fds[last];
+	w->fdidx[w->fds[i].fd] = i + 1;
+    }
+    w->nfds--;
+}
+
+/* Add the descriptors given with -W to a watcher, or remove them. */
+
+static int
+zselwatchadd(char *nam, Zselwatch w, struct zselargs *za)
+{
+    static const short pollev[3] = { POLLIN, POLLOUT, POLLPRI };
+    int i, j, ret = 0;
+    VARARR(char, isnew, za->n);
+
+#ifdef ZSELECT_EPOLL
+    if (zselepollfd(nam, w))
+	return 1;
+#endif
+    for (j = 0; j < za->n; j++) {
+	int fd = za->a[j].fd;
+
+	if ((i = zselwatchidx(w, fd)) >= 0 && za->a[j].ind == ZSEL_DEL)
+	    zselwatchdel(w, i);
+    }
+    /*
+     * The conditions given now replace any there were before, so
+     * clear them first and then add them up.
+     */
+    for (j = 0; j < za->n; j++) {
+	int fd = za->a[j].fd;
+
+	isnew[j] = 0;
+	if (za->a[j].ind == ZSEL_DEL)
+	    continue;
+	if ((i = zselwatchidx(w, fd)) < 0) {
+	    if (fd >= w->fdidxsz) {
+		int osz = w->fdidxsz;
+
+		w->fdidxsz = fd + 32;
+		w->fdidx = (int *) zrealloc(w->fdidx,
+					    w->fdidxsz * sizeof(int));
+		memset(w->fdidx + osz, 0, (w->fdidxsz - osz) * sizeof(int));
+	    }
+	    if (w->nfds == w->fdssz) {
+		int osz = w->fdssz;
+
+		w->fdssz = osz ? osz * 2 : 16;
+		w->fds = (struct pollfd *)
+		    zrealloc(w->fds, w->fdssz * sizeof(*w->fds));
+#ifdef ZSELECT_EPOLL
+		w->always = (char *) zrealloc(w->always, w->fdssz);
+		memset(w->always + osz, 0, w->fdssz - osz);
+#endif
+	    }
+	    i = w->nfds++;
+	    w->fds[i].fd = fd;
+	    w->fdidx[fd] = i + 1;
+	    isnew[j] = 1;
+	}
+	w->fds[i].events = 0;
+    }
+    for (j = 0; j < za->n; j++)
+	if (za->a[j].ind != ZSEL_DEL) {
+	    i = zselwatchidx(w, za->a[j].fd);
+	    w->fds[i].events |= pollev[za->a[j].ind];
+	}
+#ifdef ZSELECT_EPOLL
+    for (j = 0; j < za->n; j++)
+	if (za->a[j].ind != ZSEL_DEL &&
+	    (i = zselwatchidx(w, za->a[j].fd)) >= 0 &&
+	    zselepollctl(nam, w, i, isnew[j] ? EPOLL_CTL_ADD : EPOLL_CTL_MOD)) {
+	    zselwatchdel(w, i);
+	    ret = 1;
+	}
+#else
+    (void)nam;
+#endif
+    return ret;
+}
+
+/* Compare ready descriptors for sorting. */
+
+static int
+zselreadycmp(const void *a, const void *b)
+{
+    return ((const struct zselarg *) a)->fd - ((const struct zselarg *) b)->fd;
+}
+
+/*
+ * Wait for any of the descriptors in a watcher to become ready.
+ * The ready ones are put in ready, which must be big enough for
+ * all of them, with ind set to a bit mask of the ZSEL_* conditions.
+ * Returns the number ready, 0 on timeout or -1 on error.
+ */
+
+static int
+zselwatchwait(char *nam, Zselwatch w, int timeout, struct zselarg *ready)
+{
+    int i, n, nready = 0;
+
+#ifdef ZSELECT_EPOLL
+    if (zselepollfd(nam, w))
+	return -1;
+    if (!w->evs || w->evssz < w->nfds) {
+	zfree(w->evs, w->evssz * sizeof(*w->evs));
+	w->evssz = w->fdssz ? w->fdssz : 1;
+	w->evs = (struct epoll_event *) zalloc(w->evssz * sizeof(*w->evs));
+    }
+    errno = 0;
+    do {
+	n = epoll_wait(w->epfd, w->evs, w->evssz, w->nalways ? 0 : timeout);
+    } while (n < 0 && errno == EINTR && !errflag);
+    if (n < 0) {
+	zwarnnam(nam, "error on epoll_wait: %e", errno);
+	return -1;
+    }
+    for (i = 0; i < n; i++) {
+	int fd = w->evs[i].data.fd, j = zselwatchidx(w, fd), ev, mask;
+
+	if (j < 0)
+	    continue;
+	ev = w->evs[i].events;
+	ev = (((ev & EPOLLIN) ? POLLIN : 0) |
+	      ((ev & EPOLLOUT) ? POLLOUT : 0) |
+	      ((ev & EPOLLPRI) ? POLLPRI : 0) |
+	      ((ev & EPOLLHUP) ? POLLHUP : 0) |
+	      ((ev & EPOLLERR) ? POLLERR : 0));
+	if ((mask = ZSEL_RMASK(ev) & ZSEL_RMASK(w->fds[j].events))) {
+	    ready[nready].fd = fd;
+	    ready[nready++].ind = mask;
+	}
+    }
+    if (w->nalways)
+	for (i = 0; i < w->nfds; i++)
+	    if (w->always[i]) {
+		ready[nready].fd = w->fds[i].fd;
+		ready[nready++].ind = ZSEL_RMASK(w->fds[i].events);
+	    }
+#else
+    errno = 0;
+    do {
+	n = poll(w->fds, w->nfds, timeout);
+    } while (n < 0 && errno == EINTR && !errflag);
+    if (n < 0) {
+	zwarnnam(nam, "error on poll: %e", errno);
+	return -1;
+    }
+    for (i = 0; n && i < w->nfds; i++) {
+	int mask, ev = w->fds[i].revents;
+
+	if (!ev)
+	    continue;
+	n--;
+	if (ev & POLLNVAL) {
+	    zwarnnam(nam, "file descriptor %d is not open", w->fds[i].fd);
+	    return -1;
+	}
+	if ((mask = ZSEL_RMASK(ev) & ZSEL_RMASK(w->fds[i].events))) {
+	    ready[nready].fd = w->fds[i].fd;
+	    ready[nready++].ind = mask;
+	}
+    }
+#endif
+    qsort(ready, nready, sizeof(*ready), zselreadycmp);
+    return nready;
+}
+
+#endif /* HAVE_POLL */
+
+/*
+ * Store the ready descriptors in the array or association.  The
+ * array is like the arguments to zselect, the keys of the
+ * association are the descriptors and the values any of "rwe".
+ */
+
+static void
+zselsetreply(struct zselarg *ready, int nready, char *outarray,
+	     char *outhash)
+{
+    char **outdata, **outptr, buf[BDIGBUFSIZE];
+    int i, j;
+
+    outptr = outdata = (char **)
+	zalloc((outhash ? 2 * nready + 1 : 3 * nready + 4) * sizeof(char *));
+    if (outhash) {
+	for (i = 0; i < nready; i++) {
+	    char *p;
+
+	    convbase(buf, ready[i].fd, 10);
+	    *outptr++ = ztrdup(buf);
+	    for (p = buf, j = 0; j < 3; j++)
+		if (ready[i].ind & (1 << j))
+		    *p++ = fdchar[j];
+	    *p = '\0';
+	    *outptr++ = ztrdup(buf);
+	}
+    } else {
+	for (j = 0; j < 3; j++) {
+	    int doneit = 0;
+
+	    for (i = 0; i < nready; i++)
+		if (ready[i].ind & (1 << j)) {
+		    if (!doneit) {
+			buf[0] = '-';
+			buf[1] = fdchar[j];
+			buf[2] = '\0';
+			*outptr++ = ztrdup(buf);
+			doneit = 1;
+		    }
+		    convbase(buf, ready[i].fd, 10);
+		    *outptr++ = ztrdup(buf);
+		}
+	}
+    }
+    *outptr = NULL;
+    if (outhash)
+	sethparam(outhash, outdata);
+    else
+	setaparam(outarray, outdata);
+}
+
+/*
+ * Handle an fd by adding it to the list with the current condition.
  * Return 1 for error (after printing a message), 0 for OK.
  */
 static int
-handle_digits(char *nam, char *argptr, fd_set *fdset, int *fdmax)
+handle_digits(char *nam, char *argptr, int ind, struct zselargs *za)
 {
     int fd;
     char *endptr;
@@ -52,9 +476,16 @@ handle_digits(char *nam, char *argptr, fd_set *fdset, int *fdmax)
 	return 1;
     }
 
-    FD_SET(fd, fdset);
-    if (fd+1 > *fdmax)
-	*fdmax = fd+1;
+    if (za->n == za->sz) {
+	int osz = za->sz;
+
+	za->sz = osz ? osz * 2 : 8;
+	za->a = (struct zselarg *)
+	    hrealloc((char *) za->a, osz * sizeof(*za->a),
+		     za->sz * sizeof(*za->a));
+    }
+    za->a[za->n].fd = fd;
+    za->a[za->n++].ind = ind;
     return 0;
 }
 
@@ -65,16 +496,18 @@ static int
 bin_zselect(char *nam, char **args, UNUSED(Options ops), UNUSED(int func))
 {
 #ifdef HAVE_SELECT
-    int i, fd, fdsetind = 0, fdmax = 0, fdcount;
+    int i, fd, fdsetind = ZSEL_READ, fdmax = 0, fdcount;
     fd_set fdset[3];
-    const char fdchar[3] = "rwe";
     struct timeval tv, *tvptr = NULL;
     char *outarray = "reply", **outdata, **outptr;
-    char *outhash = NULL;
+    char *outhash = NULL, *watchname = NULL;
+    int watchdel = 0;
+    zlong timeout = -1;
+    struct zselargs za;
     LinkList fdlist;
 
-    for (i = 0; i < 3; i++)
-	FD_ZERO(fdset+i);
+    za.a = NULL;
+    za.n = za.sz = 0;
 
     for (; *args; args++) {
 	char *argptr = *args, *endptr;
@@ -111,19 +544,45 @@ bin_zselect(char *nam, char **args, UNUSED(Options ops), UNUSED(int func))
 			argptr++;
 		    break;
 
+		    /*
+		     * Name of a watcher to add the fd's to or, if there
+		     * are none, to wait for; with -D, to delete.
+		     */
+		case 'W':
+		case 'D':
+		    i = *argptr;
+		    if (argptr[1])
+			argptr++;
+		    else if (args[1]) {
+			argptr = *++args;
+		    } else {
+			zwarnnam(nam, "argument expected after -%c", *argptr);
+			return 1;
+		    }
+		    watchname = argptr;
+		    watchdel = (i == 'D');
+		    while (argptr[1])
+			argptr++;
+		    break;
+
 		    /* Following numbers indicate fd's for reading */
 		case 'r':
-		    fdsetind = 0;
+		    fdsetind = ZSEL_READ;
 		    break;
 
 		    /* Following numbers indicate fd's for writing */
 		case 'w':
-		    fdsetind = 1;
+		    fdsetind = ZSEL_WRITE;
 		    break;
 
 		    /* Following numbers indicate fd's for errors */
 		case 'e':
-		    fdsetind = 2;
+		    fdsetind = ZSEL_ERROR;
+		    break;
+
+		    /* Following numbers are fd's to remove from a watcher */
+		case 'd':
+		    fdsetind = ZSEL_DEL;
 		    break;
 
 		    /*
@@ -151,6 +610,7 @@ bin_zselect(char *nam, char **args, UNUSED(Options ops), UNUSED(int func))
 			return 1;
 		    }
 		    /* timevalue now active */
+		    timeout = tempnum;
 		    tvptr = &tv;
 		    tv.tv_sec = (long)(tempnum / 100);
 		    tv.tv_usec = (long)(tempnum % 100) * 10000L;
@@ -161,15 +621,79 @@ bin_zselect(char *nam, char **args, UNUSED(Options ops), UNUSED(int func))
 
 		    /* Digits following option without arguments are fd's. */
 		default:
-		    if (handle_digits(nam, argptr, fdset+fdsetind,
-				      &fdmax))
+		    if (handle_digits(nam, argptr, fdsetind, &za))
 			return 1;
+		    while (argptr[1])
+			argptr++;
 		}
 	    }
-	} else if (handle_digits(nam, argptr, fdset+fdsetind, &fdmax))
+	} else if (handle_digits(nam, argptr, fdsetind, &za))
 	    return 1;
     }
 
+    if (watchname) {
+#ifdef HAVE_POLL
+	Zselwatch w = findzselwatch(watchname);
+	int nready;
+
+	if (watchdel) {
+	    if (!w) {
+		zwarnnam(nam, "no such watcher: %s", watchname);
+		return 1;
+	    }
+	    deletezselwatch(w);
+	    return 0;
+	}
+	if (za.n) {
+	    if (!w) {
+		w = (Zselwatch) zshcalloc(sizeof(*w));
+		w->name = ztrdup(watchname);
+#ifdef ZSELECT_EPOLL
+		w->epfd = -1;
+#endif
+		w->next = zselwatches;
+		zselwatches = w;
+	    }
+	    return zselwatchadd(nam, w, &za);
+	}
+	if (!w) {
+	    zwarnnam(nam, "no such watcher: %s", watchname);
+	    return 1;
+	} else {
+	    VARARR(struct zselarg, ready, w->nfds + 1);
+
+	    nready = zselwatchwait(nam, w,
+				   (timeout < 0 ? -1 :
+				    timeout > INT_MAX / 10 ? INT_MAX :
+				    (int) (timeout * 10)), ready);
+	    if (nready <= 0)
+		return 1;
+	    zselsetreply(ready, nready, outarray, outhash);
+	    return 0;
+	}
+#else
+	zwarnnam(nam, "watchers need the poll system call");
+	return 2;
+#endif
+    }
+
+    for (i = 0; i < 3; i++)
+	FD_ZERO(fdset+i);
+    for (i = 0; i < za.n; i++) {
+	fd = za.a[i].fd;
+	if (za.a[i].ind == ZSEL_DEL) {
+	    zwarnnam(nam, "-d is only valid with -W");
+	    return 1;
+	}
+	if (fd >= FD_SETSIZE) {
+	    zwarnnam(nam, "file descriptor too large for select: %d", fd);
+	    return 1;
+	}
+	FD_SET(fd, fdset + za.a[i].ind);
+	if (fd+1 > fdmax)
+	    fdmax = fd+1;
+    }
+
     errno = 0;
     do {
 	i = select(fdmax, (SELECT_ARG_2_T)fdset, (SELECT_ARG_2_T)(fdset+1),
@@ -317,6 +841,10 @@ boot_(UNUSED(Module m))
 int
 cleanup_(Module m)
 {
+#ifdef HAVE_POLL
+    while (zselwatches)
+	deletezselwatch(zselwatches);
+#endif
     return setfeatureenables(m, &module_features, NULL);
 }
 
@@ -83,12 +83,14 @@ freematch(MatchData *m)
 
 typedef struct stypat *Stypat;
 typedef struct style *Style;
+typedef struct styidx *Styidx;
 
 /* A pattern and the styles for it. */
 
 struct style {
     struct hashnode node;
     Stypat pats;		/* patterns */
+    Styidx idx;			/* index of the patterns, or NULL */
 };
 
 struct stypat {
@@ -98,18 +100,60 @@ struct stypat {
     int weight;			/* how specific is the pattern? */
     Eprog eval;			/* eval-on-retrieve? */
     char **vals;
+    char *field;		/* literal context field, see stypatfield() */
+    int pos;			/* position in the list, set by the index */
+    Stypat fnext;		/* next in the index with the same hash */
+};
+
+/*
+ * Index of the patterns of a style with many of them.  Patterns with a
+ * literal field can only match contexts that contain the same field, so
+ * they are hashed by that field and only tried for contexts with it.
+ * All other patterns are tried for every context.  The index is built
+ * when it is first needed and thrown away when a pattern changes.
+ */
+
+#define STYIDX_MIN 8
+
+struct styidx {
+    int npats;			/* number of patterns of the style */
+    Stypat *any;		/* patterns without a literal field */
+    int nany;
+    Stypat *fields;		/* the others, hashed by field */
+    int nfields;		/* size of fields */
 };
 
 /* Hash table of styles and associated functions. */
 
 static HashTable zstyletab;
 
+/*
+ * Cache for lookupstyle():  the pattern that matched for a style name
+ * and a context, or NULL if none did.  Completion looks up the same
+ * styles in the same contexts over and over again.  Entries are only
+ * valid if they have the current generation number, which is changed
+ * whenever a pattern is added, changed or removed.
+ */
+
+#define ZSTYLE_CACHE_SIZE 1024
+
+struct zstylecache {
+    char *style;
+    char *ctxt;
+    Stypat pat;
+    unsigned gen;
+};
+
+static struct zstylecache zstyle_cache[ZSTYLE_CACHE_SIZE];
+static unsigned zstyle_gen = 1;
+
 /* Memory stuff. */
 
 static void
 freestylepatnode(Stypat p)
 {
     zsfree(p->pat);
+    zsfree(p->field);
     freepatprog(p->prog);
     if (p->vals)
 	freearray(p->vals);
@@ -118,12 +162,27 @@ freestylepatnode(Stypat p)
     zfree(p, sizeof(*p));
 }
 
+static void
+freestyidx(Style s)
+{
+    Styidx i = s->idx;
+
+    if (i) {
+	zfree(i->any, i->npats * sizeof(Stypat));
+	zfree(i->fields, i->nfields * sizeof(Stypat));
+	zfree(i, sizeof(*i));
+	s->idx = NULL;
+    }
+}
+
 static void
 freestylenode(HashNode hn)
 {
     Style s = (Style) hn;
     Stypat p, pn;
 
+    freestyidx(s);
+
     p = s->pats;
     while (p) {
 	pn = p->next;
@@ -149,7 +208,9 @@ freestylenode(HashNode hn)
 static void
 freestypat(Stypat p, Style s, Stypat prev)
 {
+    zstyle_gen++;
     if (s) {
+	freestyidx(s);
 	if (prev)
 	    prev->next = p->next;
 	else
@@ -287,6 +348,124 @@ newzstyletable(int size, char const *name)
     return ht;
 }
 
+/*
+ * Find a field of a context pattern that is a literal string, i.e.
+ * a part delimited by colons or the ends of the pattern containing no
+ * pattern characters.  Any context the pattern matches has to contain
+ * the same field.  We use the last such field, since fields further
+ * to the right are usually more specific.  Patterns with any of the
+ * characters that could make a colon part of something else are left
+ * alone.  Returns NULL if there is no such field.
+ */
+
+static char *
+stypatfield(char *pat)
+{
+    char *f, *e, *field = NULL;
+    int fl = 0;
+
+    if (strpbrk(pat, "\\[]()<>|~^#"))
+	return NULL;
+    for (f = pat; ; f = e + 1) {
+	for (e = f; *e && *e != ':'; e++)
+	    if (*e == '*' || *e == '?')
+		break;
+	if (*e == '*' || *e == '?') {
+	    if (!(e = strchr(e, ':')))
+		break;
+	    continue;
+	}
+	if (e > f) {
+	    field = f;
+	    fl = e - f;
+	}
+	if (!*e)
+	    break;
+    }
+    return field ? ztrduppfx(field, fl) : NULL;
+}
+
+/* Build the index of the patterns of a style. */
+
+static void
+mkstyidx(Style s)
+{
+    Styidx i = (Styidx) zshcalloc(sizeof(*i));
+    Stypat p, *q;
+    int n;
+
+    for (n = 0, p = s->pats; p; p = p->next)
+	n++;
+    i->npats = n;
+    i->any = (Stypat *) zalloc(n * sizeof(Stypat));
+    for (i->nfields = 16; i->nfields < n; i->nfields <<= 1);
+    i->fields = (Stypat *) zshcalloc(i->nfields * sizeof(Stypat));
+
+    /* Keep the patterns in each list in the original order. */
+    for (n = 0, p = s->pats; p; p = p->next) {
+	p->pos = n++;
+	p->fnext = NULL;
+	if (p->field) {
+	    for (q = i->fields + (hasher(p->field) & (i->nfields - 1)); *q;
+		 q = &(*q)->fnext);
+	    *q = p;
+	} else
+	    i->any[i->nany++] = p;
+    }
+    s->idx = i;
+}
+
+static int
+stypatposcmp(const void *a, const void *b)
+{
+    return (*(Stypat *)a)->pos - (*(Stypat *)b)->pos;
+}
+
+/*
+ * Find the first pattern of a style matching a context using the
+ * index.  Collects the patterns that might match and tries them in
+ * the original order.
+ */
+
+static Stypat
+idxstypat(Style s, char *ctxt)
+{
+    Styidx i = s->idx;
+    VARARR(Stypat, cands, i->npats);
+    VARARR(char *, flds, strlen(ctxt) + 2);
+    Stypat p;
+    char *c, *f;
+    int nc, nf, j;
+
+    memcpy(cands, i->any, i->nany * sizeof(Stypat));
+    nc = i->nany;
+    for (nf = 0, c = f = dupstring(ctxt); ; c++) {
+	if (*c == ':' || !*c) {
+	    int end = !*c;
+
+	    *c = '\0';
+	    for (j = 0; j < nf && strcmp(flds[j], f); j++);
+	    if (*f && j == nf) {
+		flds[nf++] = f;
+		for (p = i->fields[hasher(f) & (i->nfields - 1)]; p;
+		     p = p->fnext)
+		    if (!strcmp(p->field, f))
+			cands[nc++] = p;
+	    }
+	    if (end)
+		break;
+	    f = c + 1;
+	}
+    }
+    if (nc > i->nany)
+	qsort(cands, nc, sizeof(Stypat), stypatposcmp);
+    for (j = 0; j < nc; j++)
+	if (pattry(cands[j]->prog, ctxt))
+	    return cands[j];
+
+    return NULL;
+}
+
 /* Store a value for a style. */
 
 static int
@@ -297,6 +476,8 @@ setstypat(Style s, char *pat, Patprog prog, char **vals, int eval)
     Stypat p, q, qq;
     Eprog eprog = NULL;
 
+    zstyle_gen++;
+    freestyidx(s);
     if (eval) {
 	int ef = errflag;
 
@@ -335,6 +516,7 @@ setstypat(Style s, char *pat, Patprog prog, char **vals, int eval)
     p->prog = prog;
     p->vals = zarrdup(vals);
     p->eval = eprog;
+    p->field = stypatfield(pat);
     p->next = NULL;
 
     /* Calculate the weight. */
@@ -419,21 +601,57 @@ evalstyle(Stypat p)
 static char **
 lookupstyle(char *ctxt, char *style)
 {
+    struct zstylecache *c;
     Style s;
-    Stypat p;
+    Stypat p = NULL;
     char **found = NULL;
-
+    int gen = zstyle_gen;
+    MatchData match;
+
+    c = zstyle_cache +
+	(hasher(style) * 31 + hasher(ctxt)) % ZSTYLE_CACHE_SIZE;
+    if (c->gen == gen && !strcmp(c->style, style) &&
+	!strcmp(c->ctxt, ctxt)) {
+	if ((p = c->pat)) {
+	    if (p->eval) {
+		savematch(&match);
+		/* set up any backreferences from the context pattern */
+		pattry(p->prog, ctxt);
+		found = evalstyle(p);
+		restorematch(&match);
+	    } else
+		found = p->vals;
+	}
+	return found;
+    }
     s = (Style)zstyletab->getnode2(zstyletab, style);
     if (s) {
-	MatchData match;
 	savematch(&match);
-	for (p = s->pats; p; p = p->next)
-	    if (pattry(p->prog, ctxt)) {
-		found = (p->eval ? evalstyle(p) : p->vals);
-		break;
-	    }
+	if (!s->idx && s->pats && s->pats->next) {
+	    int n;
+
+	    for (n = 0, p = s->pats; p && n < STYIDX_MIN; p = p->next)
+		n++;
+	    if (n == STYIDX_MIN)
+		mkstyidx(s);
+	}
+	if (s->idx)
+	    p = idxstypat(s, ctxt);
+	else
+	    for (p = s->pats; p && !pattry(p->prog, ctxt); p = p->next);
+	if (p)
+	    found = (p->eval ? evalstyle(p) : p->vals);
 	restorematch(&match);
     }
+    /* A zstyle -e style may have changed the styles and freed p. */
+    if (gen != zstyle_gen)
+	return found;
+    zsfree(c->style);
+    zsfree(c->ctxt);
+    c->style = ztrdup(style);
+    c->ctxt = ztrdup(ctxt);
+    c->pat = p;
+    c->gen = gen;
 
     return found;
 }
@@ -590,8 +808,10 @@ bin_zstyle(char *nam, char **args, UNUSED(Options ops), UNUSED(int func))
 		    scanhashtable(zstyletab, 0, 0, 0, scanpatstyles,
 				  ZSPAT_REMOVE);
 		}
-	    } else
+	    } else {
 		zstyletab->emptytable(zstyletab);
+		zstyle_gen++;
+	    }
 	}
 	break;
     case 's':
@@ -2037,7 +2257,15 @@ cleanup_(Module m)
 int
 finish_(UNUSED(Module m))
 {
+    int i;
+
     deletehashtable(zstyletab);
+    for (i = 0; i < ZSTYLE_CACHE_SIZE; i++) {
+	zsfree(zstyle_cache[i].style);
+	zsfree(zstyle_cache[i].ctxt);
+	zstyle_cache[i].style = zstyle_cache[i].ctxt = NULL;
+	zstyle_cache[i].gen = 0;
+    }
 
     return 0;
 }
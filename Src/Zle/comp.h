@@ -301,6 +301,13 @@ struct menuinfo {
 #define CAF_KEYS    64    /* compadd -k: assoc parameter names */
 #define CAF_ALL    128    /* compadd -C: _all_matches */
 
+/* Characters that are never changed by quoting them for completion. */
+
+#define CQ_PLAIN(C) \
+    ((((C) >= 'a' && (C) <= 'z') || ((C) >= 'A' && (C) <= 'Z') || \
+      ((C) >= '0' && (C) <= '9') || (C) == '_' || (C) == '-' || \
+      (C) == '.' || (C) == '/') && (C) != bangchar)
+
 /* Data for compadd and addmatches() */
 
 typedef struct cadata *Cadata;
@@ -327,8 +334,38 @@ struct cadata {
     char *disp;			/* array with display lists (-d) */
     char *mesg;			/* message to show unconditionally (-x) */
     int dummies;               /* add that many dummy matches */
+    char **dispv;		/* display strings already fetched, or NULL */
+    char **ignv;		/* ignored suffixes already fetched, or NULL */
+};
+
+/* A compadd call recorded for compreuse. */
+
+typedef struct cadrec *Cadrec;
+
+struct cadrec {
+    Cadrec next;
+    struct cadata dat;		/* the options, strings copied */
+    char **words;		/* the words to add */
+    char *prefix;		/* values of the completion variables */
+    char *suffix;		/*  at the time of the call */
+    char *iprefix;
+    char *isuffix;
 };
 
+/* The compadd calls recorded for one completion attempt. */
+
+struct cadcache {
+    char **key;			/* the context the attempt was made in */
+    char *prefix;		/* PREFIX at the start */
+    Cadrec recs;		/* the calls in order... */
+    Cadrec *tail;		/* ...and where to add the next one */
+    int state;			/* CRS_* */
+};
+
+#define CRS_OFF  0		/* not recording */
+#define CRS_ON   1		/* recording */
+#define CRS_BAD  2		/* recording abandoned */
+
 /* List data. */
 
 typedef struct cldata *Cldata;
@@ -431,9 +468,11 @@ typedef void (*CLPrintFunc)(Cmgroup, Cmatch *, int, int, int, int);
 #define CP_QUOTES      (1 << CPN_QUOTES)
 #define CPN_IGNORED    25
 #define CP_IGNORED     (1 << CPN_IGNORED)
+#define CPN_TYPEAHEAD  26
+#define CP_TYPEAHEAD   (1 << CPN_TYPEAHEAD)
 /* See compkpms */
-#define CP_KEYPARAMS   26
-#define CP_ALLKEYS     ((unsigned int) 0x3ffffff)
+#define CP_KEYPARAMS   27
+#define CP_ALLKEYS     ((unsigned int) 0x7ffffff)
 
 /* Hooks. */
 
@@ -48,6 +48,32 @@ mod_export int dolastprompt;
 /**/
 mod_export int oldlist, oldins;
 
+/*
+ * Reusing the matches of the previous completion attempt.  Once a
+ * completion function has called compreuse, the compadd calls it makes
+ * are recorded together with the state the completion was started in.
+ * If the next attempt is started in the same state, except that the
+ * word's prefix is longer, compreuse can make the recorded calls again
+ * with the new prefix instead of running the functions that generated
+ * the matches.
+ */
+
+/* The attempt being made and the last one successfully recorded. */
+
+static struct cadcache cadcur, cadlast;
+
+/*
+ * Non-zero if the completion attempt was abandoned because something
+ * was typed, see checktypeahead().
+ */
+
+/**/
+int compabandoned;
+
+/* When the completion function was called. */
+
+static struct timespec compstarttime;
+
 /* Original prefix/suffix lengths. Flag saying if they changed. */
 
 /**/
@@ -336,6 +362,8 @@ do_completion(UNUSED(Hookdef dummy), Compldat dat)
     minmlen = 1000000;
     maxmlen = -1;
     compignored = 0;
+    comptypeahead = 0;
+    compabandoned = 0;
     nmessages = 0;
     hasallmatch = 0;
 
@@ -347,9 +375,10 @@ do_completion(UNUSED(Hookdef dummy), Compldat dat)
 	inststr(origline);
 	zlemetacs = origcs;
 	clearlist = 1;
-	ret = 1;
+	/* Don't beep if the user has simply typed on. */
+	ret = !compabandoned;
 	minfo.cur = NULL;
-	if (useline < 0) {
+	if (useline < 0 && !compabandoned) {
 	    /* unmetafy line before calling ZLE */
 	    unmetafy_line();
 	    ret = selfinsert(zlenoargs);
@@ -552,6 +581,7 @@ callcompfunc(char *s, char *fn)
     if ((shfunc = getshfunc(fn))) {
 	char **p, *tmp;
 	int aadd = 0, usea = 1, icf = incompfunc, osc = sfcontext;
+	int ogdc = glob_dircache;
 	unsigned int rset, kset;
 	Param *ocrpms = comprpms, *ockpms = compkpms;
 
@@ -812,6 +842,11 @@ callcompfunc(char *s, char *fn)
 	compoldlist = ztrdup(compoldlist);
 	compoldins = ztrdup(compoldins);
 
+	freecadcache(&cadcur);
+	cadcur.key = makecadkey(fn);
+	cadcur.prefix = ztrdup(compprefix);
+
+	zgettime(&compstarttime);
 	incompfunc = 1;
 	startparamscope();
 	makecompparams();
@@ -830,12 +865,29 @@ callcompfunc(char *s, char *fn)
 		while (*p)
 		    addlinknode(largs, dupstring(*p++));
 	    }
+	    glob_dircache = 1;
 	    cfret = doshfunc(shfunc, largs, 1);
+	    if (!(glob_dircache = ogdc))
+		freedircache();
 	} OLDHEAPS;
 	sfcontext = osc;
 	endparamscope();
 	lastcmd = 0;
 	incompfunc = icf;
+	if (compabandoned)
+	    errflag &= ~ERRFLAG_INT;
+
+	if (cadcur.state == CRS_ON && !errflag && !compabandoned &&
+	    !(comppatmatch && *comppatmatch)) {
+	    freecadcache(&cadlast);
+	    cadlast = cadcur;
+	    cadlast.tail = NULL;
+	    memset(&cadcur, 0, sizeof(cadcur));
+	} else {
+	    if (cadcur.state == CRS_BAD)
+		freecadcache(&cadlast);
+	    freecadcache(&cadcur);
+	}
 	startauto = 0;
 
 	if (!complist)
@@ -930,6 +982,32 @@ callcompfunc(char *s, char *fn)
     lastval = lv;
 }
 
+/*
+ * Called when a shell function is about to be run or matches are
+ * added by a completion widget.  If compstate[typeahead] has been
+ * set, the attempt has been going on for at least that many
+ * milliseconds and something has been typed since, give up so that
+ * the input can be handled straight away.
+ */
+
+/**/
+void
+checktypeahead(void)
+{
+    struct timespec now;
+    zlong ms;
+
+    if (comptypeahead <= 0 || compabandoned || errflag)
+	return;
+    zgettime(&now);
+    ms = (zlong)(now.tv_sec - compstarttime.tv_sec) * 1000 +
+	(now.tv_nsec - compstarttime.tv_nsec) / 1000000;
+    if (ms >= comptypeahead && noquery(0)) {
+	compabandoned = 1;
+	errflag |= ERRFLAG_INT;
+    }
+}
+
 /* Create the completion list.  This is called whenever some bit of   *
  * completion code needs the list.                                    *
  * Along with the list is maintained the prefixes/suffixes etc.  When *
@@ -1026,7 +1104,7 @@ makecomplist(char *s, int incmd, int lst)
 	hasperm = 0;
 	hasoldlist = 1;
 
-	if ((nmatches || nmessages) && !errflag) {
+	if ((nmatches || nmessages) && !errflag && !compabandoned) {
 	    validlist = 1;
 
 	    redup(osi, 0);
@@ -1062,14 +1140,19 @@ mod_export char *
 multiquote(char *s, int ign)
 {
     if (s) {
-	char *os = s, *p = compqstack;
+	char *os = s, *p = compqstack, *t;
 
 	if (p && *p && (ign == 0 || p[1])) {
-	    if (ign)
-		p++;
-	    while (*p) {
-		s = quotestring(s, *p);
-		p++;
+	    /* Most matches don't contain anything that would be quoted. */
+	    for (t = s; CQ_PLAIN(*t); t++)
+		;
+	    if (*t || t == s) {
+		if (ign)
+		    p++;
+		while (*p) {
+		    s = quotestring(s, *p);
+		    p++;
+		}
 	    }
 	}
 	return (s == os ? dupstring(s) : s);
@@ -2047,6 +2130,227 @@ addmatch(char *str, int flags, char ***dispp, int line)
     *dispp = disp;
 }
 
+/* Describe the context of the completion attempt being started. */
+
+/**/
+static char **
+makecadkey(char *fn)
+{
+    char **key, **p, **w, buf[DIGBUFSIZE];
+    int i, nw = compwords ? arrlen(compwords) : 0;
+
+    p = key = (char **) zalloc((nw + 14 + arrlen(cfargs)) * sizeof(char *));
+    *p++ = ztrdup(fn);
+    *p++ = ztrdup(pwd ? pwd : "");
+    *p++ = ztrdup(compcontext);
+    *p++ = ztrdup(compparameter);
+    *p++ = ztrdup(compredirect);
+    *p++ = ztrdup(compquote);
+    *p++ = ztrdup(compqiprefix);
+    *p++ = ztrdup(compqisuffix);
+    *p++ = ztrdup(compiprefix);
+    *p++ = ztrdup(compisuffix);
+    *p++ = ztrdup(compsuffix);
+    *p++ = ztrdup(compvared);
+    sprintf(buf, "%d %d", (int) compcurrent, arrlen(cfargs));
+    *p++ = ztrdup(buf);
+    for (w = cfargs; *w; w++)
+	*p++ = ztrdup(*w);
+    /* The current word is represented by the prefix. */
+    for (i = 0; i < nw; i++)
+	*p++ = ztrdup(i == compcurrent - 1 ? "" : compwords[i]);
+    *p = NULL;
+
+    return key;
+}
+
+static int
+cadkeyeq(char **a, char **b)
+{
+    if (!a || !b)
+	return 0;
+    for (; *a && *b; a++, b++)
+	if (strcmp(*a, *b))
+	    return 0;
+    return !*a && !*b;
+}
+
+static void
+freecadrecs(Cadrec r)
+{
+    Cadrec n;
+
+    for (; r; r = n) {
+	n = r->next;
+	zsfree(r->dat.ipre);
+	zsfree(r->dat.isuf);
+	zsfree(r->dat.ppre);
+	zsfree(r->dat.psuf);
+	zsfree(r->dat.prpre);
+	zsfree(r->dat.pre);
+	zsfree(r->dat.suf);
+	zsfree(r->dat.group);
+	zsfree(r->dat.rems);
+	zsfree(r->dat.remf);
+	zsfree(r->dat.exp);
+	zsfree(r->dat.mesg);
+	if (r->dat.dispv)
+	    freearray(r->dat.dispv);
+	if (r->dat.ignv)
+	    freearray(r->dat.ignv);
+	freecmatcher(r->dat.match);
+	freearray(r->words);
+	zsfree(r->prefix);
+	zsfree(r->suffix);
+	zsfree(r->iprefix);
+	zsfree(r->isuffix);
+	zfree(r, sizeof(*r));
+    }
+}
+
+/**/
+static void
+freecadcache(struct cadcache *c)
+{
+    if (c->key)
+	freearray(c->key);
+    zsfree(c->prefix);
+    freecadrecs(c->recs);
+    memset(c, 0, sizeof(*c));
+}
+
+/* Record a call to compadd while recording. */
+
+static void
+recordadd(Cadata dat, char **argv)
+{
+    Cadrec r;
+    char **a;
+
+    if (!(dat->aflags & CAF_MATCH) || brbeg || brend) {
+	/* We can't tell which matches a longer prefix would select. */
+	cadcur.state = CRS_BAD;
+	return;
+    }
+    r = (Cadrec) zalloc(sizeof(*r));
+    r->next = NULL;
+    r->dat = *dat;
+    r->dat.ipre = ztrdup(dat->ipre);
+    r->dat.isuf = ztrdup(dat->isuf);
+    r->dat.ppre = ztrdup(dat->ppre);
+    r->dat.psuf = ztrdup(dat->psuf);
+    r->dat.prpre = ztrdup(dat->prpre);
+    r->dat.pre = ztrdup(dat->pre);
+    r->dat.suf = ztrdup(dat->suf);
+    r->dat.group = ztrdup(dat->group);
+    r->dat.rems = ztrdup(dat->rems);
+    r->dat.remf = ztrdup(dat->remf);
+    r->dat.exp = ztrdup(dat->exp);
+    r->dat.mesg = ztrdup(dat->mesg);
+    /* Arrays named by the options may well be local to the caller. */
+    r->dat.disp = r->dat.ign = NULL;
+    a = (dat->dispv ? dat->dispv : get_user_var(dat->disp));
+    r->dat.dispv = (a ? zarrdup(a) : NULL);
+    a = (dat->ignv ? dat->ignv : get_user_var(dat->ign));
+    r->dat.ignv = (a ? zarrdup(a) : NULL);
+    if (r->dat.match)
+	r->dat.match->refc++;
+    if (dat->aflags & CAF_ARRAYS) {
+	LinkList l = newlinklist();
+
+	for (; *argv; argv++)
+	    if ((a = get_data_arr(*argv, (dat->aflags & CAF_KEYS))))
+		while (*a)
+		    addlinknode(l, *a++);
+	r->words = zlinklist2array(l);
+	r->dat.aflags &= ~(CAF_ARRAYS|CAF_KEYS);
+    } else
+	r->words = zarrdup(argv);
+    r->prefix = ztrdup(compprefix);
+    r->suffix = ztrdup(compsuffix);
+    r->iprefix = ztrdup(compiprefix);
+    r->isuffix = ztrdup(compisuffix);
+
+    *cadcur.tail = r;
+    cadcur.tail = &r->next;
+}
+
+/*
+ * The compreuse builtin.  If discard is set, don't keep the matches
+ * of this attempt.  Otherwise start recording and, if the last attempt
+ * can be reused, add its matches again; returns zero if anything was
+ * added.
+ */
+
+/**/
+int
+reusematches(int discard)
+{
+    Cadrec r, *otail;
+    char *ext, *oprefix, *osuffix, *oiprefix, *oisuffix;
+    int omnum = mnum, omesg = nmessages;
+
+    if (discard) {
+	cadcur.state = CRS_BAD;
+	return 0;
+    }
+    if (cadcur.state == CRS_OFF) {
+	cadcur.state = CRS_ON;
+	cadcur.tail = &cadcur.recs;
+    }
+    if (cadcur.state != CRS_ON || !cadlast.recs ||
+	!cadkeyeq(cadlast.key, cadcur.key) ||
+	!strpfx(cadlast.prefix, cadcur.prefix))
+	return 1;
+    /*
+     * Each call had the prefix at the start, possibly with some
+     * of it moved to IPREFIX, so the new characters go at the end.
+     */
+    for (r = cadlast.recs; r; r = r->next)
+	if (!strsfx(r->prefix, cadlast.prefix))
+	    return 1;
+    ext = cadcur.prefix + strlen(cadlast.prefix);
+
+    otail = cadcur.tail;
+    oprefix = compprefix;
+    osuffix = compsuffix;
+    oiprefix = compiprefix;
+    oisuffix = compisuffix;
+    for (r = cadlast.recs; r; r = r->next) {
+	struct cadata dat = r->dat;
+
+	compprefix = tricat(r->prefix, ext, "");
+	compsuffix = r->suffix;
+	compiprefix = r->iprefix;
+	compisuffix = r->isuffix;
+	addmatches(&dat, arrdup(r->words));
+	zsfree(compprefix);
+    }
+    compprefix = oprefix;
+    compsuffix = osuffix;
+    compiprefix = oiprefix;
+    compisuffix = oisuffix;
+
+    if (mnum == omnum && nmessages == omesg) {
+	/* Nothing left, so let the caller generate matches itself. */
+	freecadrecs(*otail);
+	*otail = NULL;
+	cadcur.tail = otail;
+	return 1;
+    }
+    return 0;
+}
+
+/* Called when the completion module is unloaded. */
+
+/**/
+void
+freecadcaches(void)
+{
+    freecadcache(&cadcur);
+    freecadcache(&cadlast);
+}
+
 /* This is used by compadd to add a couple of matches. The arguments are
  * the strings given via options. The last argument is the array with
  * the matches. */
@@ -2073,6 +2377,12 @@ addmatches(Cadata dat, char **argv)
     Brinfo bp, bpl = brbeg, obpl, bsl = brend, obsl;
     Heap oldheap;
 
+    checktypeahead();
+    if (compabandoned)
+	return 1;
+    if (cadcur.state == CRS_ON && !dat->apar && !dat->opar && !dat->dpar)
+	recordadd(dat, argv);
+
     SWITCHHEAPS(oldheap, compheap) {
         if (dat->dummies >= 0)
             dat->aflags = ((dat->aflags | CAF_NOSORT | CAF_UNIQCON) &
@@ -2181,7 +2491,8 @@ addmatches(Cadata dat, char **argv)
 	    update_bmatchers();
 
 	/* Get the suffixes to ignore. */
-	if (dat->ign && (aign = get_user_var(dat->ign))) {
+	if ((aign = (dat->ignv ? arrdup(dat->ignv) :
+		     get_user_var(dat->ign)))) {
 	    char **ap, **sp, *tmp;
 	    Patprog *pp, prog;
 
@@ -2205,7 +2516,9 @@ addmatches(Cadata dat, char **argv)
 		pign = NULL;
 	}
 	/* Get the display strings. */
-	if (dat->disp)
+	if (dat->dispv)
+	    disp = dat->dispv - 1;
+	else if (dat->disp)
 	    if ((disp = get_user_var(dat->disp)))
 		disp--;
 	/* Get the contents of the completion variables if we have
@@ -2420,6 +2733,8 @@ addmatches(Cadata dat, char **argv)
 	/* Walk through the matches given. */
 	obpl = bpl;
 	obsl = bsl;
+	if ((dat->aflags & CAF_MATCH) && !cp)
+	    build_mfilter(lpre);
 	if (dat->aflags & CAF_ARRAYS) {
 	    Heap oldheap2;
 
@@ -2493,7 +2808,8 @@ addmatches(Cadata dat, char **argv)
 		    sl = strlen(ms = multiquote(s, 0));
 		lc = bld_parts(ms, sl, -1, NULL, NULL);
 		isexact = 0;
-	    } else if (!(ms = comp_match(lpre, lsuf, s, cp, &lc,
+	    } else if ((!cp && mfilter_reject(s)) ||
+		       !(ms = comp_match(lpre, lsuf, s, cp, &lc,
 					 (!(dat->aflags & CAF_QUOTE) ?
 					  (dat->ppre ||
 					   !(dat->flags & CMF_FILE) ? 1 : 2) : 0),
@@ -3163,6 +3479,82 @@ matcheq(Cmatch a, Cmatch b)
 	  matchstreq(a->str, b->str);
 }
 
+/* Hash the strings compared by matcheq(). */
+
+#define matchstrhash(s) ((s) ? hasher(s) : 0)
+
+/**/
+static unsigned
+matchhash(Cmatch m)
+{
+    unsigned h = matchstrhash(m->str);
+
+    h = h * 31 + matchstrhash(m->ipre);
+    h = h * 31 + matchstrhash(m->pre);
+    h = h * 31 + matchstrhash(m->ppre);
+    h = h * 31 + matchstrhash(m->psuf);
+    return h * 31 + matchstrhash(m->suf);
+}
+
+/* Remove duplicates from an unsorted array of matches, keeping the  *
+ * first of each set of equal matches, and mark those that would show *
+ * the same string in the list.  This gives the same result as        *
+ * comparing every match with all later ones but uses hash tables to  *
+ * stay linear.  Returns the new number of matches.                   */
+
+/**/
+static int
+uniqmatches(Cmatch *rp, int n)
+{
+    int sz, mask, i, j, *keep, *mt, *st;
+    unsigned h;
+
+    for (sz = 16; sz < 2 * n; sz <<= 1);
+    mask = sz - 1;
+    keep = (int *) zhalloc(n * sizeof(int));
+    mt = (int *) zhalloc(sz * sizeof(int));
+    st = (int *) zhalloc(sz * sizeof(int));
+    for (i = 0; i < sz; i++)
+	mt[i] = st[i] = -1;
+
+    /* keep[i] is the index of the first match equal to match i. */
+    for (i = 0; i < n; i++) {
+	for (h = matchhash(rp[i]) & mask; (j = mt[h]) >= 0;
+	     h = (h + 1) & mask)
+	    if (matcheq(rp[j], rp[i]))
+		break;
+	if (j < 0)
+	    mt[h] = keep[i] = i;
+	else
+	    keep[i] = j;
+    }
+    /* st maps the string of a match without a display string to the *
+     * first such match that is kept.  A later match with the same    *
+     * string is a duplicate in the list unless it is only a copy of  *
+     * a match before that one (those went before it could be seen). */
+    for (i = 0; i < n; i++) {
+	if (rp[i]->disp)
+	    continue;
+	for (h = hasher(rp[i]->str) & mask; (j = st[h]) >= 0;
+	     h = (h + 1) & mask)
+	    if (!strcmp(rp[j]->str, rp[i]->str))
+		break;
+	if (j < 0) {
+	    if (keep[i] == i)
+		st[h] = i;
+	} else if (keep[i] > j && !(rp[i]->flags & CMF_MULT)) {
+	    rp[i]->flags |= CMF_MULT;
+	    rp[j]->flags |= CMF_FMULT;
+	}
+    }
+    for (i = j = 0; i < n; i++)
+	if (keep[i] == i)
+	    rp[j++] = rp[i];
+    rp[j] = NULL;
+
+    return j;
+}
+
 /* Make an array from a linked list. The second argument says whether *
  * the array should be sorted. The third argument is used to return   *
  * the number of elements in the resulting array. The fourth argument *
@@ -3235,28 +3627,8 @@ makearray(LinkList l, int type, int flags, int *np, int *nlp, int *llp)
 	    }
 	} else {
 	    if (!(flags & CGF_UNIQALL) && !(flags & CGF_UNIQCON)) {
-                int dup;
-
-		for (ap = rp; *ap; ap++) {
-		    for (bp = cp = ap + 1; *bp; bp++) {
-			if (!matcheq(*ap, *bp))
-			    *cp++ = *bp;
-			else
-			    n--;
-		    }
-		    *cp = NULL;
-                    if (!(*ap)->disp) {
-                        for (dup = 0, bp = ap + 1; *bp; bp++)
-                            if (!(*bp)->disp &&
-                                !((*bp)->flags & CMF_MULT) &&
-                                !strcmp((*ap)->str, (*bp)->str)) {
-                                (*bp)->flags |= CMF_MULT;
-                                dup = 1;
-                            }
-                        if (dup)
-                            (*ap)->flags |= CMF_FMULT;
-                    }
-		}
+		/* Without sorting equal matches need not be adjacent. */
+		n = uniqmatches(rp, n);
 	    } else if (!(flags & CGF_UNIQCON)) {
 		int dup;
 
@@ -2096,20 +2096,61 @@ getcpat(char *str, int cpatindex, char *cpat, int class)
     return -1;
 }
 
+/* Get the longest leading part of the prefix that every name in a hash *
+ * table must start with to be accepted by addmatch(), or NULL if there *
+ * is none.  This is only possible if the prefix is compared literally, *
+ * i.e. without matchers or patterns, and only for characters that are  *
+ * not changed by quoting.                                              */
+
+/**/
+static char *
+dumpprefix(int what)
+{
+    char *p1, *p2, *r;
+    int l;
+
+    if (mstack || patcomp || what == -1 || what == -5 || what == -6 ||
+	what == -7 || what == -8 || what == CC_FILES)
+	return NULL;
+    if (what == CC_QUOTEFLAG) {
+	p1 = qrpre;
+	p2 = rpre;
+    } else {
+	p1 = qlpre;
+	p2 = lpre;
+    }
+    if (!p1 || !p2)
+	return NULL;
+    for (l = 0; p1[l] && p1[l] == p2[l] && CQ_PLAIN(p1[l]); l++);
+    if (!l)
+	return NULL;
+    r = dupstring(p1);
+    r[l] = '\0';
+
+    return r;
+}
+
 /* Dump a hash table (without sorting).  For each element the addmatch  *
  * function is called and at the beginning the addwhat variable is set. *
  * This could be done using scanhashtable(), but this is easy and much  *
- * more efficient.                                                      */
+ * more efficient.  If the names have to start with a known prefix, we  *
+ * only look at those with that prefix.                                 */
 
 /**/
 static void
 dumphashtable(HashTable ht, int what)
 {
-    HashNode hn;
+    HashNode hn, *hp;
+    char *pfx;
     int i;
 
     addwhat = what;
 
+    if (!ht->scantab && (pfx = dumpprefix(what))) {
+	for (hp = prefixnodes(ht, pfx); (hn = *hp); hp++)
+	    addmatch(dupstring(hn->nam), (char *) hn);
+	return;
+    }
     for (i = 0; i < ht->hsize; i++)
 	for (hn = ht->nodes[i]; hn; hn = hn->next)
 	    addmatch(dupstring(hn->nam), (char *) hn);
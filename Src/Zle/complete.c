@@ -38,7 +38,8 @@ zlong compcurrent,
       complistmax;
 /**/
 zlong complistlines,
-      compignored;
+      compignored,
+      comptypeahead;
 
 /**/
 mod_export
@@ -575,6 +576,7 @@ bin_compadd(char *name, char **argv, UNUSED(Options ops), UNUSED(int func))
 	dat.pre = dat.suf = dat.group = dat.rems = dat.remf = dat.disp = 
 	dat.ign = dat.exp = dat.apar = dat.opar = dat.dpar = NULL;
     dat.match = NULL;
+    dat.dispv = dat.ignv = NULL;
     dat.flags = 0;
     dat.aflags = CAF_MATCH;
     dat.dummies = -1;
@@ -786,6 +788,17 @@ bin_compadd(char *name, char **argv, UNUSED(Options ops), UNUSED(int func))
     return added;
 }
 
+/**/
+static int
+bin_compreuse(char *name, UNUSED(char **argv), Options ops, UNUSED(int func))
+{
+    if (incompfunc != 1) {
+	zwarnnam(name, "can only be called from completion function");
+	return 1;
+    }
+    return reusematches(OPT_ISSET(ops, 'd'));
+}
+
 #define CVT_RANGENUM 0
 #define CVT_RANGEPAT 1
 #define CVT_PRENUM   2
@@ -1222,6 +1235,7 @@ static struct compparam compkparams[] = {
     { "list_lines", PM_INTEGER | PM_READONLY, NULL, GSU(listlines_gsu) },
     { "all_quotes", PM_SCALAR | PM_READONLY, NULL, GSU(compqstack_gsu) },
     { "ignored", PM_INTEGER | PM_READONLY, VAL(compignored), NULL },
+    { "typeahead", PM_INTEGER, VAL(comptypeahead), NULL },
     { NULL, 0, NULL, NULL }
 };
 
@@ -1521,6 +1535,7 @@ comp_wrapper(Eprog prog, FuncWrap w, char *name)
 	owords = zarrdup(compwords);
 	oredirs = zarrdup(compredirs);
 
+	checktypeahead();
 	runshfunc(prog, w, name);
 
 	if (comprestore && !strcmp(comprestore, "auto")) {
@@ -1615,6 +1630,7 @@ cond_range(char **a, int id)
 static struct builtin bintab[] = {
     BUILTIN("compadd", BINF_HANDLES_OPTS, bin_compadd, 0, -1, 0, NULL, NULL),
     BUILTIN("compset", 0, bin_compset, 1, 3, 0, NULL, NULL),
+    BUILTIN("compreuse", 0, bin_compreuse, 0, 0, 0, "d", NULL),
 };
 
 static struct conddef cotab[] = {
@@ -1750,6 +1766,7 @@ finish_(UNUSED(Module m))
     zsfree(compoldlist);
     zsfree(compoldins);
     zsfree(compvared);
+    freecadcaches();
 
     hascompmod = 0;
 
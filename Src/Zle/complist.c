@@ -1356,7 +1356,7 @@ static int
 compprintlist(int showall)
 {
     static int lasttype = 0, lastbeg = 0, lastml = 0, lastinvcount = -1;
-    static int lastn = 0, lastnl = 0, lastnlnct = -1;
+    static int lastn = 0, lastnl = 0, lastnlnct = -1, lastpi = 0;
     static Cmgroup lastg = NULL;
     static Cmatch *lastp = NULL;
     static Cexpl *lastexpl = NULL;
@@ -1518,8 +1518,8 @@ compprintlist(int showall)
 	    }
 	} else if (!listdat.onlyexpl &&
 		   (g->lcount || (showall && g->mcount))) {
-	    int n = g->dcount, nl, nc, i, j, wid;
-	    Cmatch *q;
+	    int n = g->dcount, nl, nc, i, wid, lc, pi, qi;
+	    Cmatch *q, **lv;
 
 	    nl = nc = g->lins;
 
@@ -1588,14 +1588,15 @@ compprintlist(int showall)
 			tcout(TCCLEAREOD);
 		}
 	    }
+	    lv = listedmatches(g, showall, &lc);
 	    if (!lastused && lasttype == 3) {
-		p = lastp;
+		pi = lastpi;
 		n = lastn;
 		nl = lastnl;
 		ml = lastml;
 		lastused = 1;
 	    } else
-		p = skipnolist(g->matches, showall);
+		pi = 0;
 
 	    while (n && nl-- && !errflag) {
 		if (!lasttype && ml >= mlbeg) {
@@ -1603,16 +1604,17 @@ compprintlist(int showall)
 		    lastg = g;
 		    lastbeg = mlbeg;
 		    lastml = ml;
-		    lastp = p;
+		    lastpi = pi;
 		    lastn = n;
 		    lastnl = nl + 1;
 		    lastused = 1;
 		}
 		i = g->cols;
 		mc = 0;
-		q = p;
+		qi = pi;
 		while (n && i-- && !errflag) {
 		    wid = (g->widths ? g->widths[mc] : g->width);
+		    q = lv[qi];
 		    if (!(m = *q)) {
 			if (clprintm(g, NULL, mc, ml, (!i), wid))
 			    goto end;
@@ -1632,10 +1634,9 @@ compprintlist(int showall)
 		    if (mfirstl < 0)
 			mfirstl = ml;
 
-		    if (--n)
-			for (j = ((g->flags & CGF_ROWS) ? 1 : nc);
-			     j && *q; j--)
-			    q = skipnolist(q + 1, showall);
+		    if (--n &&
+			(qi += ((g->flags & CGF_ROWS) ? 1 : nc)) > lc)
+			qi = lc;
 		    mc++;
 		}
 		while (i-- > 0) {
@@ -1653,10 +1654,9 @@ compprintlist(int showall)
 			if (tccan(TCCLEAREOD))
 			    tcout(TCCLEAREOD);
 		    }
-		    if (nl)
-			for (j = ((g->flags & CGF_ROWS) ? g->cols : 1);
-			     j && *p; j--)
-			    p = skipnolist(p + 1, showall);
+		    if (nl &&
+			(pi += ((g->flags & CGF_ROWS) ? g->cols : 1)) > lc)
+			pi = lc;
 		}
 		if (!mnew && ml > mlend)
 		    goto end;
@@ -1106,6 +1106,133 @@ match_parts(char *l, char *w, int n, int part)
     return ret;
 }
 
+/*
+ * Quick reject test used by addmatches() before calling comp_match().
+ *
+ * Most of the words handed to compadd don't match at all, and for those
+ * comp_match() still has to quote the word and run match_str() over it.
+ * Instead we look at the leading plain characters of the prefix from
+ * the line once per call and build, for each of them, the set of word
+ * characters the current matchers could possibly pair it with.  A word
+ * whose characters can't supply such a sequence can't match either.
+ *
+ * This only handles the common kinds of match specifications: `m:'
+ * and `M:' specs mapping one character to one character, and specs
+ * with an empty line pattern (like `r:|=*' or `l:|[._-]=*') with
+ * anchors of at most one character, which allow characters in the word
+ * to be skipped.  With anything else the filter is switched off and
+ * every word goes through comp_match() as before.  The sets may contain
+ * more characters than really needed, that only means some words are
+ * tested the slow way.
+ */
+
+/* How many characters of the prefix we look at. */
+
+#define MFILTER_MAX 16
+
+#define MFILTER_HAS(S, C) ((S)[(C) >> 3] & (1 << ((C) & 7)))
+
+/* Number of prefix characters in mfilter_sets, zero if not active. */
+
+static int mfilter_len;
+
+/* Non-zero if characters in the word may be skipped. */
+
+static int mfilter_skip;
+
+/* The sets of word characters, one bit per ASCII character. */
+
+static unsigned char mfilter_sets[MFILTER_MAX][16];
+
+/* Add the word characters matched by wp to set if lp matches c. */
+
+/**/
+static void
+mfilter_pair(unsigned char *set, Cpattern lp, Cpattern wp, int c)
+{
+    int mt, x;
+
+    if (!pattern_match1(lp, c, &mt))
+	return;
+    for (x = 1; x < 128; x++)
+	if (pattern_match1(wp, x, &mt))
+	    set[x >> 3] |= 1 << (x & 7);
+}
+
+/* Set up the filter for the prefix pfx and the matchers in mstack. */
+
+/**/
+mod_export void
+build_mfilter(char *pfx)
+{
+    Cmlist ms;
+    Cmatcher mp;
+    int n, c;
+
+    mfilter_len = mfilter_skip = 0;
+
+    for (ms = mstack; ms; ms = ms->next)
+	for (mp = ms->matcher; mp; mp = mp->next) {
+	    if (!mp->llen) {
+		if (mp->lalen > 1 || mp->ralen > 1)
+		    return;
+		mfilter_skip = 1;
+	    } else if (mp->llen != 1 || mp->wlen != 1 ||
+		       (mp->flags & (CMF_LEFT | CMF_RIGHT)))
+		return;
+	}
+    for (n = 0; n < MFILTER_MAX && CQ_PLAIN(pfx[n]); n++) {
+	unsigned char *set = mfilter_sets[n];
+
+	c = pfx[n];
+	memset(set, 0, sizeof(mfilter_sets[n]));
+	set[c >> 3] |= 1 << (c & 7);
+	for (ms = mstack; ms; ms = ms->next)
+	    for (mp = ms->matcher; mp; mp = mp->next) {
+		if (mp->llen)
+		    mfilter_pair(set, mp->line, mp->word, c);
+		else {
+		    /* Be generous, anchors are compared in more than one
+		     * way in match_str(). */
+		    if (mp->lalen) {
+			mfilter_pair(set, mp->left, mp->left, c);
+			if (mp->ralen)
+			    mfilter_pair(set, mp->left, mp->right, c);
+		    }
+		    if (mp->ralen) {
+			mfilter_pair(set, mp->right, mp->right, c);
+			if (mp->lalen)
+			    mfilter_pair(set, mp->right, mp->left, c);
+		    }
+		}
+	    }
+    }
+    mfilter_len = n;
+}
+
+/* Return non-zero if the word w can't match the prefix given to
+ * build_mfilter(). */
+
+/**/
+mod_export int
+mfilter_reject(char *w)
+{
+    int n;
+
+    for (n = 0; n < mfilter_len; n++, w++) {
+	if (mfilter_skip)
+	    while (CQ_PLAIN(*w) && !MFILTER_HAS(mfilter_sets[n], *w))
+		w++;
+	if (!*w)
+	    return mfilter_skip;
+	if (!CQ_PLAIN(*w))
+	    return 0;
+	if (!MFILTER_HAS(mfilter_sets[n], *w))
+	    return 1;
+    }
+    return 0;
+}
+
 /* Check if the word w is matched by the strings in pfx and sfx (the prefix
  * and the suffix from the line) or the pattern cp. In clp a cline list for
  * w is returned.
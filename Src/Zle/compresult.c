@@ -1476,6 +1476,33 @@ skipnolist(Cmatch *p, int showall)
     return p;
 }
 
+/*
+ * Return a heap array of pointers to the matches of g that are listed,
+ * followed by one pointing to the terminating NULL, and their number in
+ * *np.  With it the match n places after another one in the list can be
+ * found directly instead of calling skipnolist() n times, which made
+ * printing lists in columns quadratic in the number of matches.
+ */
+
+/**/
+mod_export Cmatch **
+listedmatches(Cmgroup g, int showall, int *np)
+{
+    Cmatch **v, *p;
+    int n;
+
+    for (n = 0, p = g->matches; *p; p++)
+	n++;
+    v = (Cmatch **) zhalloc((n + 1) * sizeof(Cmatch *));
+    for (n = 0, p = skipnolist(g->matches, showall); *p;
+	 p = skipnolist(p + 1, showall))
+	v[n++] = p;
+    v[n] = p;
+    *np = n;
+
+    return v;
+}
+
 /**/
 mod_export int
 calclist(int showall)
@@ -2075,8 +2102,8 @@ printlist(int over, CLPrintFunc printm, int showall)
 	    }
 	} else if (!listdat.onlyexpl &&
 		   (g->lcount || (showall && g->mcount))) {
-	    int n = g->dcount, nl, nc, i, j, wid;
-	    Cmatch *q;
+	    int n = g->dcount, nl, nc, i, wid, lc, pi, qi;
+	    Cmatch *q, **lv;
 
 	    nl = nc = g->lins;
 
@@ -2109,12 +2136,14 @@ printlist(int over, CLPrintFunc printm, int showall)
 			tcout(TCCLEAREOD);
 		}
 	    }
-	    for (p = skipnolist(g->matches, showall); n && nl--;) {
+	    lv = listedmatches(g, showall, &lc);
+	    for (pi = 0; n && nl--;) {
 		i = g->cols;
 		mc = 0;
-		q = p;
+		qi = pi;
 		while (n && i--) {
 		    wid = (g->widths ? g->widths[mc] : g->width);
+		    q = lv[qi];
 		    if (!(m = *q)) {
 			printm(g, NULL, mc, ml, (!i), wid);
 			break;
@@ -2123,10 +2152,9 @@ printlist(int over, CLPrintFunc printm, int showall)
 
 		    printed++;
 
-		    if (--n)
-			for (j = ((g->flags & CGF_ROWS) ? 1 : nc);
-			     j && *q; j--)
-			    q = skipnolist(q + 1, showall);
+		    if (--n &&
+			(qi += ((g->flags & CGF_ROWS) ? 1 : nc)) > lc)
+			qi = lc;
 		    mc++;
 		}
 		while (i-- > 0) {
@@ -2142,10 +2170,9 @@ printlist(int over, CLPrintFunc printm, int showall)
 			if (tccan(TCCLEAREOD))
 			    tcout(TCCLEAREOD);
 		    }
-		    if (nl)
-			for (j = ((g->flags & CGF_ROWS) ? g->cols : 1);
-			     j && *p; j--)
-			    p = skipnolist(p + 1, showall);
+		    if (nl &&
+			(pi += ((g->flags & CGF_ROWS) ? g->cols : 1)) > lc)
+			pi = lc;
 		}
 	    }
 	} else
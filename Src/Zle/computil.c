@@ -903,7 +903,7 @@ typedef struct caarg *Caarg;
 /* Cache for a set of _arguments-definitions. */
 
 struct cadef {
-    Cadef next;			/* next in cache */
+    Cadef next;			/* next in cache bucket */
     Cadef snext;		/* next set */
     Caopt opts;			/* the options */
     int nopts, ndopts, nodopts;	/* number of options/direct/optional direct */
@@ -912,7 +912,10 @@ struct cadef {
     char **defs;		/* the original strings */
     int ndefs;			/* number of ... */
     int lastt;			/* last time this was used */
+    unsigned hval;		/* hash value of defs */
     Caopt *single;		/* array of single-letter options */
+    Caopt *ohash;		/* hash table of options by name */
+    int ohmask;			/* its size minus one */
     char *match;		/* -M spec to use */
     int argsactive;		/* if normal arguments are still allowed */
 				/* used while parsing a command line */
@@ -927,6 +930,7 @@ struct cadef {
 
 struct caopt {
     Caopt next;
+    Caopt hnext;		/* next in hash bucket, in the order of next */
     char *name;			/* option name */
     char *descr;		/* the description */
     char **xor;			/* if this, then not ... */
@@ -967,10 +971,19 @@ struct caarg {
 #define CAA_RARGS  4
 #define CAA_RREST  5
 
-/* The cache of parsed descriptons. */
+/*
+ * The cache of parsed descriptons.  This is a hash table keyed on the
+ * definitions, holding at most cadef_max entries; if it's full, the one
+ * used least recently is thrown away.  The size can be changed and the
+ * statistics shown with `comparguments -C'.
+ */
 
-#define MAX_CACACHE 8
-static Cadef cadef_cache[MAX_CACACHE];
+#define CACACHE_BUCKETS 128
+#define DEF_CACACHE 64
+static Cadef cadef_cache[CACACHE_BUCKETS];
+static int cadef_max = DEF_CACACHE, cadef_count;
+static int cadef_uses;
+static long cadef_hits, cadef_misses;
 
 /* Compare two arrays of strings for equality. */
 
@@ -1036,6 +1049,8 @@ freecadef(Cadef d)
 	zsfree(d->nonarg);
 	if (d->single)
 	    zfree(d->single, 256 * sizeof(Caopt));
+	if (d->ohash)
+	    zfree(d->ohash, (d->ohmask + 1) * sizeof(Caopt));
 	zfree(d, sizeof(*d));
 	d = s;
     }
@@ -1148,6 +1163,8 @@ alloc_cadef(char **args, int single, char *match, char *nonarg, int flags)
     ret->nopts = 0;
     ret->ndopts = 0;
     ret->nodopts = 0;
+    ret->ohash = NULL;
+    ret->ohmask = 0;
     ret->lastt = time(0);
     ret->set = NULL;
     if (single) {
@@ -1165,7 +1182,8 @@ static void
 set_cadef_opts(Cadef def)
 {
     Caarg argp;
-    int xnum;
+    Caopt p, *q;
+    int xnum, size;
 
     for (argp = def->args, xnum = 0; argp; argp = argp->next) {
 	if (!argp->direct)
@@ -1173,6 +1191,20 @@ set_cadef_opts(Cadef def)
 	if (argp->type == CAA_OPT)
 	    xnum++;
     }
+    /* Build the hash table used by ca_get_opt().  Options with the same
+     * name (or hash value) stay in the order of the list, so the
+     * first one found in a bucket is also the first one in the list. */
+    for (size = 16; size < 2 * def->nopts; size <<= 1)
+	;
+    def->ohash = (Caopt *) zshcalloc(size * sizeof(Caopt));
+    def->ohmask = size - 1;
+    for (p = def->opts; p; p = p->next) {
+	for (q = def->ohash + (hasher(p->name) & def->ohmask); *q;
+	     q = &(*q)->hnext)
+	    ;
+	*q = p;
+	p->hnext = NULL;
+    }
 }
 
 /* Parse an array of definitions. */
@@ -1655,27 +1687,67 @@ parse_cadef(char *nam, char **args)
     return all;
 }
 
+/* Hash value for the cache of an array of definitions. */
+
+static unsigned
+hash_cadef(char **args)
+{
+    unsigned h = 0;
+
+    while (*args)
+	h = h * 31 + hasher(*args++);
+
+    return h;
+}
+
+/* Remove the least recently used entry from the cache. */
+
+static void
+drop_cadef(void)
+{
+    Cadef *p, *min = NULL;
+    int i;
+
+    for (i = 0; i < CACACHE_BUCKETS; i++)
+	for (p = cadef_cache + i; *p; p = &(*p)->next)
+	    if (!min || (*p)->lastt < (*min)->lastt)
+		min = p;
+    if (min) {
+	Cadef d = *min;
+
+	*min = d->next;
+	d->next = NULL;
+	freecadef(d);
+	cadef_count--;
+    }
+}
+
 /* Given an array of definitions, return the cadef for it. From the cache
  * are newly built. */
 
 static Cadef
 get_cadef(char *nam, char **args)
 {
-    Cadef *p, *min, new;
-    int i, na = arrlen(args);
+    Cadef p, new;
+    int na = arrlen(args);
+    unsigned h = hash_cadef(args);
 
-    for (i = MAX_CACACHE, p = cadef_cache, min = NULL; i && *p; p++, i--)
-	if (*p && na == (*p)->ndefs && arrcmp(args, (*p)->defs)) {
-	    (*p)->lastt = time(0);
+    for (p = cadef_cache[h % CACACHE_BUCKETS]; p; p = p->next)
+	if (p->hval == h && na == p->ndefs && arrcmp(args, p->defs)) {
+	    p->lastt = ++cadef_uses;
+	    cadef_hits++;
 
-	    return *p;
-	} else if (!min || !*p || (*p)->lastt < (*min)->lastt)
-	    min = p;
-    if (i > 0)
-	min = p;
+	    return p;
+	}
+    cadef_misses++;
     if ((new = parse_cadef(nam, args))) {
-	freecadef(*min);
-	*min = new;
+	while (cadef_count >= cadef_max)
+	    drop_cadef();
+	new->hval = h;
+	new->lastt = ++cadef_uses;
+	new->next = cadef_cache[h % CACACHE_BUCKETS];
+	cadef_cache[h % CACACHE_BUCKETS] = new;
+	cadef_count++;
     }
     return new;
 }
@@ -1694,11 +1766,14 @@ get_cadef(char *nam, char **args)
 static Caopt
 ca_get_opt(Cadef d, char *line, int full, char **end)
 {
-    Caopt p;
+    Caopt p, best;
+    unsigned h;
+    char *s;
+    int l;
 
     /* The full string may be an option. */
 
-    for (p = d->opts; p; p = p->next)
+    for (p = d->ohash[hasher(line) & d->ohmask]; p; p = p->hnext)
 	if (p->active && !strcmp(p->name, line)) {
 	    if (end)
 		*end = line + strlen(line);
@@ -1707,25 +1782,35 @@ ca_get_opt(Cadef d, char *line, int full, char **end)
 	}
 
     if (!full) {
-	/* The string from the line probably only begins with an option. */
-	for (p = d->opts; p; p = p->next)
-	    if (p->active && ((!p->args || p->type == CAO_NEXT) ?
-			      !strcmp(p->name, line) : strpfx(p->name, line))) {
-		int l = strlen(p->name);
+	/* The string from the line probably only begins with an option.
+	 * Look up every prefix of it, calculating the hash value as
+	 * hasher() does, and use the option that comes first in the
+	 * list. */
+	for (best = NULL, h = 0, s = line; *s; ) {
+	    h += (h << 5) + STOUC(*s);
+	    l = ++s - line;
+	    for (p = d->ohash[h & d->ohmask]; p; p = p->hnext)
+		if ((!best || p->num < best->num) && p->active &&
+		    !p->name[l] && !strncmp(p->name, line, l) &&
+		    ((!p->args || p->type == CAO_NEXT) ? !line[l] :
+		     !((p->type == CAO_OEQUAL || p->type == CAO_EQUAL) &&
+		       line[l] && line[l] != '='))) {
+		    best = p;
+		    break;
+		}
+	}
+	if ((p = best)) {
+	    l = strlen(p->name);
+	    if (end) {
+		/* Return a pointer to the end of the option. */
 		if ((p->type == CAO_OEQUAL || p->type == CAO_EQUAL) &&
-		    line[l] && line[l] != '=')
-		    continue;
+		    line[l] == '=')
+		    l++;
 
-		if (end) {
-		    /* Return a pointer to the end of the option. */
-		    if ((p->type == CAO_OEQUAL || p->type == CAO_EQUAL) &&
-			line[l] == '=')
-			l++;
-
-		    *end = line + l;
-		}
-		return p;
+		*end = line + l;
 	    }
+	    return p;
+	}
     }
     return NULL;
 }
@@ -1781,7 +1866,7 @@ ca_foreign_opt(Cadef curset, Cadef all, char *option)
 	if (d == curset)
 	    continue;
 
-	for (p = d->opts; p; p = p->next) {
+	for (p = d->ohash[hasher(option) & d->ohmask]; p; p = p->hnext) {
 	    if (!strcmp(p->name, option))
 		return 1;
 	}
@@ -2543,6 +2628,33 @@ bin_comparguments(char *nam, char **args, UNUSED(Options ops), UNUSED(int func))
     int min, max, n;
     Castate lstate = &ca_laststate;
 
+    if (!strcmp(args[0], "-C")) {
+	/* Show the cache statistics or change the size of the cache.
+	 * This can be used outside of completion functions. */
+	if (args[1]) {
+	    char *eptr;
+	    int max = (int) zstrtol(args[1], &eptr, 10);
+
+	    if (*eptr || max < 1) {
+		zwarnnam(nam, "invalid cache size: %s", args[1]);
+		return 1;
+	    }
+	    if (args[2]) {
+		zwarnnam(nam, "too many arguments");
+		return 1;
+	    }
+	    cadef_max = max;
+	    if (cadef_count > cadef_max) {
+		/* The parsed state may refer to a definition we drop. */
+		ca_parsed = 0;
+		while (cadef_count > cadef_max)
+		    drop_cadef();
+	    }
+	} else
+	    printf("size: %d\nentries: %d\nhits: %ld\nmisses: %ld\n",
+		   cadef_max, cadef_count, cadef_hits, cadef_misses);
+	return 0;
+    }
     if (incompfunc != 1) {
 	zwarnnam(nam, "can only be called from completion function");
 	return 1;
@@ -5066,6 +5178,7 @@ int
 setup_(UNUSED(Module m))
 {
     memset(cadef_cache, 0, sizeof(cadef_cache));
+    cadef_count = 0;
     memset(cvdef_cache, 0, sizeof(cvdef_cache));
 
     memset(comptags, 0, sizeof(comptags));
@@ -5110,8 +5223,14 @@ finish_(UNUSED(Module m))
 {
     int i;
 
-    for (i = 0; i < MAX_CACACHE; i++)
-	freecadef(cadef_cache[i]);
+    for (i = 0; i < CACACHE_BUCKETS; i++) {
+	Cadef d, n;
+
+	for (d = cadef_cache[i]; d; d = n) {
+	    n = d->next;
+	    freecadef(d);
+	}
+    }
     for (i = 0; i < MAX_CVCACHE; i++)
 	freecvdef(cvdef_cache[i]);
 
@@ -386,6 +386,220 @@ zle_free_highlight(void)
     free_colour_buffer();
 }
 
+/*
+ * To find the highlighting for each character of the line without
+ * testing every region, the regions are kept sorted by where they
+ * start and we sweep along the line keeping a list of those that
+ * cover the current position.  The attributes only change where a
+ * region starts or ends, so most characters just reuse the result.
+ *
+ * The order of the regions from region_highlight is kept between
+ * refreshes.  Editing the line moves regions without changing
+ * their order, so it's usually still valid; it's checked before
+ * use and sorted again only if necessary.
+ */
+
+/* Indexes of the user's regions in order of start position */
+static int *rhorder;
+/* Number of entries used in rhorder, and its size */
+static int rhorder_n, rhorder_sz;
+
+static struct rhsweep {
+    int *order;		/* all regions in order of start position */
+    int norder, ordersz;
+    int nextord;	/* next entry in order to start */
+    int *active;	/* regions covering position, by index */
+    int nactive, activesz;
+    int next;		/* next position where active changes */
+    int minend;		/* first position past an active region */
+    zattr on;		/* attributes from active regions */
+} sweep;
+
+/* Start and end in the display line of a highlighted region. */
+
+static int
+rhstart(int ireg)
+{
+    struct region_highlight *rhp = region_highlights + ireg;
+    return rhp->start + ((rhp->flags & ZRH_PREDISPLAY) ? 0 : predisplaylen);
+}
+
+static int
+rhend(int ireg)
+{
+    struct region_highlight *rhp = region_highlights + ireg;
+    return rhp->end + ((rhp->flags & ZRH_PREDISPLAY) ? 0 : predisplaylen);
+}
+
+static int
+rhstartcmp(const void *a, const void *b)
+{
+    int ia = *(const int *)a, ib = *(const int *)b;
+    int sa = rhstart(ia), sb = rhstart(ib);
+
+    return sa < sb ? -1 : sa > sb ? 1 : ia - ib;
+}
+
+/* Make sure rhorder holds the user's regions in order. */
+
+static void
+sortregions(void)
+{
+    int i, n = n_region_highlights - N_SPECIAL_HIGHLIGHTS;
+
+    if (n < 0)
+	n = 0;
+    if (n != rhorder_n) {
+	if (n > rhorder_sz) {
+	    rhorder = (int *)zrealloc(rhorder, n * sizeof(*rhorder));
+	    rhorder_sz = n;
+	}
+	for (i = 0; i < n; i++)
+	    rhorder[i] = i + N_SPECIAL_HIGHLIGHTS;
+	rhorder_n = n;
+    } else {
+	for (i = 1; i < n; i++)
+	    if (rhstartcmp(rhorder + i - 1, rhorder + i) > 0)
+		break;
+	if (i >= n)
+	    return;
+    }
+    qsort(rhorder, n, sizeof(*rhorder), rhstartcmp);
+}
+
+/*
+ * Work out which regions cover position pos, which must be
+ * beyond the position last looked at, and what they turn on.
+ * ll is the length of the line.
+ */
+
+static void
+sweepregions(int pos, int ll)
+{
+    int i, j, ireg, end, changed = 0;
+    struct region_highlight *rhp;
+
+    /* Drop regions that have finished... */
+    for (i = j = 0; i < sweep.nactive; i++) {
+	if (rhend(sweep.active[i]) > pos)
+	    sweep.active[j++] = sweep.active[i];
+	else
+	    changed = 1;
+    }
+    sweep.nactive = j;
+    /* ...and add those that have started, keeping them in order. */
+    while (sweep.nextord < sweep.norder &&
+	   rhstart(ireg = sweep.order[sweep.nextord]) <= pos) {
+	sweep.nextord++;
+	if (rhend(ireg) <= pos)
+	    continue;
+	for (i = sweep.nactive; i > 0 && sweep.active[i-1] > ireg; i--)
+	    sweep.active[i] = sweep.active[i-1];
+	sweep.active[i] = ireg;
+	sweep.nactive++;
+	changed = 1;
+    }
+
+    sweep.minend = ll;
+    for (i = 0; i < sweep.nactive; i++)
+	if ((end = rhend(sweep.active[i])) < sweep.minend)
+	    sweep.minend = end;
+    sweep.next = sweep.minend;
+    if (sweep.nextord < sweep.norder &&
+	(end = rhstart(sweep.order[sweep.nextord])) < sweep.next)
+	sweep.next = end;
+
+    if (!changed)
+	return;
+    sweep.on = default_atr_on;
+    for (i = 0; i < sweep.nactive; i++) {
+	rhp = region_highlights + sweep.active[i];
+	if (rhp->atr & (TXTFGCOLOUR|TXTBGCOLOUR)) {
+	    /* override colour with later entry */
+	    sweep.on = (sweep.on & ~TXT_ATTR_ON_VALUES_MASK) | rhp->atr;
+	} else {
+	    /* no colour set yet */
+	    sweep.on |= rhp->atr;
+	}
+    }
+}
+
+/*
+ * Set up for sweeping the regions over a line of length ll,
+ * starting at position pos.
+ */
+
+static void
+startregions(int pos, int ll)
+{
+    int spec[N_SPECIAL_HIGHLIGHTS];
+    int i, j, nspec;
+
+    sortregions();
+    if (n_region_highlights > sweep.ordersz) {
+	sweep.order = (int *)zrealloc(sweep.order,
+				      n_region_highlights * sizeof(int));
+	sweep.active = (int *)zrealloc(sweep.active,
+				       n_region_highlights * sizeof(int));
+	sweep.ordersz = sweep.activesz = n_region_highlights;
+    }
+    /* The special regions change all the time, so merge them in. */
+    for (i = nspec = 0; i < N_SPECIAL_HIGHLIGHTS && i < n_region_highlights;
+	 i++) {
+	for (j = nspec; j > 0 && rhstartcmp(spec + j - 1, &i) > 0; j--)
+	    spec[j] = spec[j-1];
+	spec[j] = i;
+	nspec++;
+    }
+    sweep.norder = 0;
+    for (i = j = 0; i < nspec || j < rhorder_n; ) {
+	if (j >= rhorder_n ||
+	    (i < nspec && rhstartcmp(spec + i, rhorder + j) < 0))
+	    sweep.order[sweep.norder++] = spec[i++];
+	else
+	    sweep.order[sweep.norder++] = rhorder[j++];
+    }
+
+    sweep.nextord = sweep.nactive = 0;
+    sweep.on = default_atr_on;
+    sweepregions(pos, ll);
+}
+
+/*
+ * Attributes to turn off after the character at pos because regions
+ * covering it end there (or the line does).
+ */
+
+static zattr
+regionsoff(int pos, int ll)
+{
+    zattr off = 0;
+    int i;
+
+    for (i = 0; i < sweep.nactive; i++) {
+	struct region_highlight *rhp = region_highlights + sweep.active[i];
+	if (pos == rhend(sweep.active[i]) - 1 || pos == ll - 1)
+	    off |= TXT_ATTR_OFF_FROM_ON(rhp->atr);
+    }
+    return off;
+}
+
+/* Free the arrays used for sorting and sweeping regions. */
+
+static void
+freeregions(void)
+{
+    if (rhorder)
+	zfree(rhorder, rhorder_sz * sizeof(*rhorder));
+    rhorder = NULL;
+    rhorder_n = rhorder_sz = 0;
+    if (sweep.order) {
+	zfree(sweep.order, sweep.ordersz * sizeof(int));
+	zfree(sweep.active, sweep.activesz * sizeof(int));
+    }
+    memset(&sweep, 0, sizeof(sweep));
+}
+
 /*
  * Interface to the region_highlight ZLE parameter.
  * Converts betwen a format like "P32 42 underline,bold" to
@@ -675,6 +889,50 @@ static int
     nmw_ind;			/* next insert point in nmw_ind */
 #endif
 
+/*
+ * Layout of the command line made by the last refresh.  Laying out
+ * a long buffer on every keystroke is expensive, so if the start of
+ * the buffer and its highlighting haven't changed we pick up the old
+ * layout at the start of the first row that may be different instead
+ * of starting again from the top.  For this we record, for every row
+ * laid out (including those that scrolled off the top of the window),
+ * where in the line it started and the scrolling state at that point,
+ * and keep the contents of enough recent rows to fill the window.
+ *
+ * Rather than relying on every editing operation to report what it
+ * changed, the line and highlighting are compared with copies taken
+ * at the last refresh; that is cheap compared with the layout itself.
+ */
+
+struct layrow {
+    int start;			/* index in line of first character   */
+				/* or -1 if row started mid-glyph     */
+    int ln;			/* line of window the row was put on  */
+    int canscroll;		/* scrolling state at start of row    */
+    int numscrolls;
+    int more_start;
+};
+
+static struct zlayout {
+    int valid;			/* the layout below can be reused	    */
+    int winw, winh, lpromptw;	/* parameters used for the layout	    */
+    int predisplaylen, combining, widthserial;
+    zattr default_atr, special_atr;
+    ZLE_STRING_T line;		/* copy of the line laid out		    */
+    int linelen, linesz;
+    int same;			/* length of unchanged start of line	    */
+    struct region_highlight *rh; /* copy of the highlighting		    */
+    int nrh, rhsz;
+    struct layrow *rows;	/* where each row started		    */
+    int nrows, rowssz;
+    int row;			/* row being laid out			    */
+    int pending;		/* start of row not yet recorded	    */
+    int mwrow;			/* first row with multiword glyph, or -1  */
+    REFRESH_STRING *ring;	/* contents of the most recent rows	    */
+    int *ringrow;		/* row held in each slot of ring	    */
+    int nring, ringw;
+} lay;
+
 /*
  * Number of words to allocate in one go for the multiword buffers.
  */
@@ -768,6 +1026,7 @@ resetvideo(void)
 
     vcs = lpromptw;
     olnct = nlnct = 0;
+    lay.valid = 0;
     if (showinglist > 0)
 	showinglist = -2;
     trashedzle = 0;
@@ -815,6 +1074,225 @@ static int cleareol,		/* clear to end-of-line (if can't cleareod) */
     oxtabs,			/* oxtabs - tabs expand to spaces if set    */
     numscrolls, onumscrolls;
 
+/* Free the saved row contents, which depend on the window size. */
+
+static void
+freelayoutring(void)
+{
+    int i;
+
+    if (lay.ring) {
+	for (i = 0; i < lay.nring; i++)
+	    zfree(lay.ring[i], (lay.ringw + 2) * sizeof(**lay.ring));
+	zfree(lay.ring, lay.nring * sizeof(*lay.ring));
+	zfree(lay.ringrow, lay.nring * sizeof(*lay.ringrow));
+	lay.ring = NULL;
+	lay.ringrow = NULL;
+    }
+    lay.valid = 0;
+}
+
+/* Free everything remembered about the last layout. */
+
+static void
+freelayout(void)
+{
+    freelayoutring();
+    if (lay.line)
+	zfree(lay.line, lay.linesz * sizeof(*lay.line));
+    if (lay.rh)
+	zfree(lay.rh, lay.rhsz * sizeof(*lay.rh));
+    if (lay.rows)
+	zfree(lay.rows, lay.rowssz * sizeof(*lay.rows));
+    memset(&lay, 0, sizeof(lay));
+}
+
+/* Make space for information about row number row of the layout. */
+
+static struct layrow *
+addlayoutrow(int row)
+{
+    if (row >= lay.rowssz) {
+	int newsz = lay.rowssz ? 2 * lay.rowssz : 64;
+	lay.rows = (struct layrow *)
+	    zrealloc(lay.rows, newsz * sizeof(*lay.rows));
+	lay.rowssz = newsz;
+    }
+    lay.row = row;
+    lay.nrows = row + 1;
+    return lay.rows + row;
+}
+
+/*
+ * Lower dam to the first position in the line affected by the
+ * highlighted region rhp, if it covers anything at all.
+ */
+
+static int
+hldamage(struct region_highlight *rhp, int dam)
+{
+    int offset = (rhp->flags & ZRH_PREDISPLAY) ? 0 : predisplaylen;
+    int start = rhp->start + offset, end = rhp->end + offset;
+
+    if (start < 0)
+	start = 0;
+    return (end > start && start < dam) ? start : dam;
+}
+
+/*
+ * Called before laying out the line to see how much of the previous
+ * layout can be kept.  If we can resume part of the way through, set
+ * up the window and rpms as they were at the start of the first row
+ * that needs laying out again and return the index in line of its
+ * first character; else return 0 to start at the top.
+ */
+
+static int
+resumelayout(Rparams rpms, ZLE_STRING_T line, int ll, int cs)
+{
+    struct layrow *lr;
+    int dam, i, v, ln;
+
+    if (!lay.ring || lay.ringw != winw || lay.nring != 2 * winh) {
+	freelayoutring();
+	lay.ringw = winw;
+	lay.nring = 2 * winh;
+	lay.ring = (REFRESH_STRING *)
+	    zalloc(lay.nring * sizeof(*lay.ring));
+	lay.ringrow = (int *)zalloc(lay.nring * sizeof(*lay.ringrow));
+	for (i = 0; i < lay.nring; i++) {
+	    lay.ring[i] = (REFRESH_STRING)
+		zalloc((winw + 2) * sizeof(**lay.ring));
+	    lay.ringrow[i] = -1;
+	}
+    }
+
+    for (dam = 0; dam < ll && dam < lay.linelen &&
+	     line[dam] == lay.line[dam]; dam++)
+	;
+    lay.same = dam;
+
+    if (!lay.valid || lay.winw != winw || lay.winh != winh ||
+	lay.lpromptw != lpromptw || lay.predisplaylen != predisplaylen ||
+	lay.combining != isset(COMBININGCHARS) ||
+	lay.widthserial != widthcacheserial ||
+	lay.default_atr != default_atr_on ||
+	lay.special_atr != special_atr_on)
+	goto fresh;
+
+    /*
+     * A row may end early because the character at the start of the
+     * next one is too wide to fit, so that character must be unchanged.
+     * The cursor position is found while laying out, so it mustn't
+     * be in the part we keep.
+     */
+    dam--;
+    if (cs < dam)
+	dam = cs;
+    for (i = 0; i < n_region_highlights || i < lay.nrh; i++) {
+	if (i >= n_region_highlights)
+	    dam = hldamage(lay.rh + i, dam);
+	else if (i >= lay.nrh)
+	    dam = hldamage(region_highlights + i, dam);
+	else if (region_highlights[i].start != lay.rh[i].start ||
+		 region_highlights[i].end != lay.rh[i].end ||
+		 region_highlights[i].atr != lay.rh[i].atr ||
+		 region_highlights[i].flags != lay.rh[i].flags) {
+	    dam = hldamage(lay.rh + i, dam);
+	    dam = hldamage(region_highlights + i, dam);
+	}
+    }
+
+    /* Find the last row we can restart from... */
+    for (v = lay.nrows - 1; v > 0; v--) {
+	lr = lay.rows + v;
+	if (lr->start >= 0 && lr->start <= dam &&
+	    (lay.mwrow < 0 || v <= lay.mwrow))
+	    break;
+    }
+    if (v <= 0)
+	goto fresh;
+    /* ...and check we still have the rows above it in the window. */
+    ln = lay.rows[v].ln;
+    for (i = v - ln; i < v; i++)
+	if (lay.ringrow[i % lay.nring] != i)
+	    goto fresh;
+
+    for (i = 0; i < ln; i++) {
+	if (!nbuf[i])
+	    nbuf[i] = (REFRESH_STRING)zalloc((winw + 2) * sizeof(**nbuf));
+	ZR_memcpy(nbuf[i], lay.ring[(v - ln + i) % lay.nring], winw + 2);
+    }
+    if (!nbuf[ln])
+	nbuf[ln] = (REFRESH_STRING)zalloc((winw + 2) * sizeof(**nbuf));
+    lr = addlayoutrow(v);
+    rpms->ln = ln;
+    rpms->canscroll = lr->canscroll;
+    numscrolls = lr->numscrolls;
+    more_start = lr->more_start;
+    rpms->s = nbuf[ln];
+    rpms->sen = rpms->s + winw;
+    lay.pending = 0;
+    lay.mwrow = -1;
+    return lr->start;
+
+ fresh:
+    lr = addlayoutrow(0);
+    memset(lr, 0, sizeof(*lr));
+    lay.pending = 0;
+    lay.mwrow = -1;
+    return 0;
+}
+
+/*
+ * Record the start of the row being laid out if it hasn't been yet.
+ * pos is the index in the line of the character about to be added.
+ */
+
+static void
+startlayoutrow(Rparams rpms, int pos)
+{
+    if (lay.pending) {
+	lay.rows[lay.row].start = (rpms->s == nbuf[rpms->ln]) ? pos : -1;
+	lay.pending = 0;
+    }
+}
+
+/* Remember what was laid out for use next time. */
+
+static void
+savelayout(ZLE_STRING_T line, int ll)
+{
+    if (ll > lay.linesz) {
+	lay.line = (ZLE_STRING_T)
+	    zrealloc(lay.line, ll * sizeof(*lay.line));
+	lay.linesz = ll;
+    }
+    if (ll > lay.same)
+	ZS_memcpy(lay.line + lay.same, line + lay.same, ll - lay.same);
+    lay.linelen = ll;
+
+    if (n_region_highlights > lay.rhsz) {
+	lay.rh = (struct region_highlight *)
+	    zrealloc(lay.rh, n_region_highlights * sizeof(*lay.rh));
+	lay.rhsz = n_region_highlights;
+    }
+    if (n_region_highlights)
+	memcpy(lay.rh, region_highlights,
+	       n_region_highlights * sizeof(*lay.rh));
+    lay.nrh = n_region_highlights;
+
+    lay.winw = winw;
+    lay.winh = winh;
+    lay.lpromptw = lpromptw;
+    lay.predisplaylen = predisplaylen;
+    lay.combining = isset(COMBININGCHARS);
+    lay.widthserial = widthcacheserial;
+    lay.default_atr = default_atr_on;
+    lay.special_atr = special_atr_on;
+    lay.valid = 1;
+}
+
 /*
  * Go to the next line in the main display area.  Return 1 if we should abort
  * processing the line loop at this point, else 0.
@@ -825,8 +1303,14 @@ static int cleareol,		/* clear to end-of-line (if can't cleareod) */
 static int
 nextline(Rparams rpms, int wrapped)
 {
+    struct layrow *lr;
+    int slot;
+
     nbuf[rpms->ln][winw+1] = wrapped ? zr_nl : zr_zr;
     *rpms->s = zr_zr;
+    slot = lay.row % lay.nring;
+    ZR_memcpy(lay.ring[slot], nbuf[rpms->ln], winw + 2);
+    lay.ringrow[slot] = lay.row;
     if (rpms->ln != winh - 1)
 	rpms->ln++;
     else {
@@ -848,6 +1332,14 @@ nextline(Rparams rpms, int wrapped)
     rpms->s = nbuf[rpms->ln];
     rpms->sen = rpms->s + winw;
 
+    lr = addlayoutrow(lay.row + 1);
+    lr->start = -1;
+    lr->ln = rpms->ln;
+    lr->canscroll = rpms->canscroll;
+    lr->numscrolls = numscrolls;
+    lr->more_start = more_start;
+    lay.pending = 1;
+
     return 0;
 }
 
@@ -1185,6 +1677,7 @@ zrefresh(void)
    width comparisons can be made with winw, height comparisons with winh */
 
     if (termflags & TERM_SHORT) {
+	lay.valid = 0;
 	singlerefresh(tmpline, tmpll, tmpcs);
 	goto singlelineout;
     }
@@ -1211,37 +1704,21 @@ zrefresh(void)
 
     rpms.s = nbuf[rpms.ln = 0] + lpromptw;
     rpms.sen = *nbuf + winw;
-    for (t = tmpline, tmppos = 0; tmppos < tmpll; t++, tmppos++) {
-	unsigned ireg;
-	zattr base_atr_on = default_atr_on, base_atr_off = 0;
+    tmppos = resumelayout(&rpms, tmpline, tmpll, tmpcs);
+    startregions(tmppos, tmpll);
+    for (t = tmpline + tmppos; tmppos < tmpll; t++, tmppos++) {
+	zattr base_atr_on, base_atr_off = 0;
 	zattr all_atr_on, all_atr_off;
-	struct region_highlight *rhp;
+
+	startlayoutrow(&rpms, tmppos);
 	/*
 	 * Calculate attribute based on region.
 	 */
-	for (ireg = 0, rhp = region_highlights;
-	     ireg < n_region_highlights;
-	     ireg++, rhp++) {
-	    int offset;
-	    if (rhp->flags & ZRH_PREDISPLAY)
-		offset = 0;	/* include predisplay in start end */
-	    else
-		offset = predisplaylen; /* increment over it */
-	    if (rhp->start + offset <= tmppos &&
-		tmppos < rhp->end + offset) {
-		if (rhp->atr & (TXTFGCOLOUR|TXTBGCOLOUR)) {
-		    /* override colour with later entry */
-		    base_atr_on = (base_atr_on & ~TXT_ATTR_ON_VALUES_MASK) |
-			rhp->atr;
-		} else {
-		    /* no colour set yet */
-		    base_atr_on |= rhp->atr;
-		}
-		if (tmppos == rhp->end + offset - 1 ||
-		    tmppos == tmpll - 1)
-		    base_atr_off |= TXT_ATTR_OFF_FROM_ON(rhp->atr);
-	    }
-	}
+	if (tmppos >= sweep.next)
+	    sweepregions(tmppos, tmpll);
+	base_atr_on = sweep.on;
+	if (tmppos >= sweep.minend - 1 || tmppos == tmpll - 1)
+	    base_atr_off = regionsoff(tmppos, tmpll);
 	if (special_atr_on & (TXTFGCOLOUR|TXTBGCOLOUR)) {
 	    /* keep colours from special attributes */
 	    all_atr_on = special_atr_on |
@@ -1334,6 +1811,8 @@ zrefresh(void)
 		     * the index into the value at the screen location.
 		     */
 		    addmultiword(rpms.s, t, ichars);
+		    if (lay.mwrow < 0)
+			lay.mwrow = lay.row;
 		} else {
 		    /* Single wide character */
 		    rpms.s->chr = *t;
@@ -1442,6 +1921,7 @@ zrefresh(void)
 	rpms.nvcs = 0;
 	rpms.nvln++;
     }
+    savelayout(tmpline, tmpll);
 
     if (t != tmpline + tmpll)
 	more_end = 1;
@@ -2794,6 +3274,8 @@ void
 zle_refresh_finish(void)
 {
     freevideo();
+    freelayout();
+    freeregions();
 
     if (region_highlights)
     {
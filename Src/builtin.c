@@ -6163,6 +6163,44 @@ bin_eval(UNUSED(char *nam), char **argv, UNUSED(Options ops), UNUSED(int func))
 static char *zbuf;
 static int readfd;
 
+/*
+ * When read takes its input from a regular file we can read a block
+ * at a time, provided we seek back over whatever wasn't used before
+ * the builtin returns.  Anything else, such as a pipe, has to be read
+ * a byte at a time so as not to take input meant for someone else.
+ */
+static char readbuf[BUFSIZ];
+static int readbuf_fd = -1, readbuf_pos, readbuf_len;
+
+/* Return the file position of readbuf_fd to just after the input used. */
+
+/**/
+static void
+zreadflush(void)
+{
+    if (readbuf_fd < 0)
+	return;
+    if (readbuf_pos < readbuf_len)
+	lseek(readbuf_fd, (off_t)(readbuf_pos - readbuf_len), SEEK_CUR);
+    readbuf_fd = -1;
+    readbuf_pos = readbuf_len = 0;
+}
+
+/* Start buffering input from fd, if it's a regular file. */
+
+/**/
+static void
+zreadbuffer(int fd)
+{
+    struct stat st;
+
+    if (readbuf_fd == fd)
+	return;
+    zreadflush();
+    if (!fstat(fd, &st) && S_ISREG(st.st_mode))
+	readbuf_fd = fd;
+}
+
 /* Read a character from readfd, or from the buffer zbuf.  Return EOF on end of
 file/buffer. */
 
@@ -6527,6 +6565,8 @@ bin_read(char *name, char **args, Options ops, UNUSED(int func))
 
     zbuforig = zbuf = (!OPT_ISSET(ops,'z')) ? NULL :
 	(nonempty(bufstack)) ? (char *) getlinknode(bufstack) : ztrdup("");
+    if (!izle && !zbuf)
+	zreadbuffer(readfd);
     first = 1;
     bslash = 0;
     while (*args || (OPT_ISSET(ops,'A') && !gotnl)) {
@@ -6696,6 +6736,8 @@ bin_read(char *name, char **args, Options ops, UNUSED(int func))
 	if (!OPT_ISSET(ops,'A'))
 	    reply = *args++;
     }
+    if (OPT_ISSET(ops,'A') || gotnl)
+	zreadflush();
     /* handle EOF */
     if (c == EOF) {
 	if (readfd == coprocin) {
@@ -6835,6 +6877,7 @@ bin_read(char *name, char **args, Options ops, UNUSED(int func))
 	    }
 	}
 	signal_setmask(s);
+	zreadflush();
     }
 #ifdef MULTIBYTE_SUPPORT
     if (ret != MB_INCOMPLETE)
@@ -6916,6 +6959,21 @@ zread(int izle, int *readchar, long izle_timeout)
 	*readchar = -1;
 	return STOUC(cc);
     }
+    if (readbuf_fd == readfd) {
+	if (readbuf_pos < readbuf_len)
+	    return STOUC(readbuf[readbuf_pos++]);
+	while ((ret = read(readfd, readbuf, sizeof(readbuf))) < 0) {
+	    if (errno != EINTR || errflag || retflag || breaks || contflag)
+		break;
+	}
+	if (ret <= 0) {
+	    readbuf_pos = readbuf_len = 0;
+	    return EOF;
+	}
+	readbuf_len = ret;
+	readbuf_pos = 1;
+	return STOUC(*readbuf);
+    }
     for (;;) {
 	/* read a character from readfd */
 	ret = read(readfd, &cc, 1);
@@ -127,6 +127,26 @@ zgettime(struct timespec *ts)
 }
 
 
+/* Provide time from a clock that isn't affected by changes of the *
+ * system time, for measuring intervals.  Falls back to zgettime(). */
+
+/**/
+mod_export int
+zmonotime(struct timespec *ts)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+    struct timespec dts;
+
+    if (!clock_gettime(CLOCK_MONOTONIC, &dts)) {
+	ts->tv_sec = (time_t) dts.tv_sec;
+	ts->tv_nsec = (long) dts.tv_nsec;
+	return 0;
+    }
+#endif
+    return zgettime(ts);
+}
+
+
 /* compute the difference between two calendar times */
 
 /**/
@@ -30,6 +30,12 @@
 #include "zsh.mdh"
 #include "exec.pro"
 
+#if defined(HAVE_POSIX_SPAWN) && defined(HAVE_SPAWN_H) && \
+    defined(POSIX_SIGNALS)
+# include <spawn.h>
+# define USE_POSIX_SPAWN 1
+#endif
+
 /* Flags for last argument of addvars */
 
 enum {
@@ -302,6 +308,36 @@ setlimits(char *nam)
 /**/
 #endif /* HAVE_GETRLIMIT */
 
+/* Monotonic time in seconds for timing commands for the exec_stats hook. */
+
+/**/
+double
+execstats_time(void)
+{
+    struct timespec ts;
+
+    zmonotime(&ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1000000000.0;
+}
+
+/*
+ * Pass the time spent in a command to the exec_stats hook functions.
+ * Callers check nonempty(EXECSTATSHOOK->funcs) first so that nothing
+ * is timed unless somebody is listening.
+ */
+
+/**/
+void
+execstats(int type, char *name, double time)
+{
+    struct execstats es;
+
+    es.type = type;
+    es.name = name;
+    es.time = time;
+    runhookdef(EXECSTATSHOOK, &es);
+}
+
 /* fork and set limits */
 
 /**/
@@ -333,6 +369,8 @@ zfork(struct timeval *tv)
 	zerr("fork failed: %e", errno);
 	return -1;
     }
+    if (pid && nonempty(EXECSTATSHOOK->funcs))
+	execstats(EXST_FORK, NULL, 0.0);
 #ifdef HAVE_GETRLIMIT
     if (!pid)
 	/* set resource limits for the child process */
@@ -2687,6 +2725,276 @@ static void execcmd_getargs(LinkList preargs, LinkList args, int expand)
     }
 }
 
+#ifdef USE_POSIX_SPAWN
+
+/*
+ * Turn the redirections for a command about to be spawned into file
+ * actions.  Only redirections whose effect is already fixed are handled,
+ * i.e. files and descriptors named without further expansion; used has
+ * a bit set for each of fds 0 to 9 already redirected, so that multios
+ * are left alone, too.  Return 0 if anything must be left to a forked
+ * shell.
+ */
+
+static int
+spawn_redirs(posix_spawn_file_actions_t *fa, LinkList redir, int used)
+{
+    LinkNode node;
+    Redir fn;
+    char *s;
+    int type, flags;
+
+    for (node = firstnode(redir); node; incnode(node)) {
+	fn = (Redir) getdata(node);
+	type = fn->type;
+	s = fn->name;
+	if (fn->varid || fn->fd1 < 0 || fn->fd1 > 9 ||
+	    (used & (1 << fn->fd1)))
+	    return 0;
+	used |= 1 << fn->fd1;
+	if (type == REDIR_MERGEIN || type == REDIR_MERGEOUT) {
+	    /*
+	     * n>&m, n>&- or >&file, sorted out as xpandredir() would.
+	     * The coprocess and descriptors above 9 are left to it.
+	     */
+	    char *t = s;
+
+	    if (IS_DASH(s[0]) && !s[1])
+		type = REDIR_CLOSE;
+	    else if (idigit(s[0]) && !s[1]) {
+		if (posix_spawn_file_actions_adddup2(fa, s[0] - '0', fn->fd1))
+		    return 0;
+		continue;
+	    } else if (type == REDIR_MERGEIN || (s[0] == 'p' && !s[1]))
+		return 0;
+	    else {
+		while (idigit(*t))
+		    t++;
+		if (!*t)
+		    return 0;
+		type = REDIR_ERRWRITE;
+	    }
+	}
+	if (type == REDIR_CLOSE) {
+	    if (posix_spawn_file_actions_addclose(fa, fn->fd1))
+		return 0;
+	    continue;
+	}
+	if (type == REDIR_READ)
+	    flags = O_RDONLY | O_NOCTTY;
+	else if (type == REDIR_READWRITE)
+	    flags = O_RDWR | O_CREAT | O_NOCTTY;
+	else if (IS_APPEND_REDIR(type))
+	    flags = ((unset(CLOBBER) && unset(APPENDCREATE)) &&
+		     !IS_CLOBBER_REDIR(type)) ?
+		O_WRONLY | O_APPEND | O_NOCTTY :
+		O_WRONLY | O_APPEND | O_CREAT | O_NOCTTY;
+	else if (IS_WRITE_FILE(type) &&
+		 (isset(CLOBBER) || IS_CLOBBER_REDIR(type)))
+	    flags = O_WRONLY | O_CREAT | O_TRUNC | O_NOCTTY;
+	else
+	    return 0;
+	if (!*s || has_token(s) ||
+	    posix_spawn_file_actions_addopen(fa, fn->fd1, dupstring(unmeta(s)),
+					     flags, 0666))
+	    return 0;
+	if (IS_ERROR_REDIR(type)) {
+	    if (used & (1 << 2))
+		return 0;
+	    used |= 1 << 2;
+	    if (posix_spawn_file_actions_adddup2(fa, fn->fd1, 2))
+		return 0;
+	}
+    }
+    return 1;
+}
+
+/*
+ * Start an external command with posix_spawn() rather than forking the
+ * shell, so that the cost doesn't grow with the shell's memory.  This
+ * is only done where the forked shell would have nothing to do but
+ * redirect, close its own descriptors and exec a command it has already
+ * found in the path; otherwise, or if the command can't be started this
+ * way, return 0 and leave it to execcmd_fork(), which also reports
+ * any errors.
+ */
+
+static int
+execcmd_spawn(LinkList args, LinkList redir, int input, int output,
+	      char *text, int oautocont, int close_if_forked)
+{
+    posix_spawn_file_actions_t fa;
+    posix_spawnattr_t attr;
+    struct timeval bgtime;
+    struct timezone dummy_tz;
+    sigset_t mask, sigdef;
+    LinkNode node;
+    Cmdnam cn;
+    char *arg0, *pth, *underscore, **argv, **envp, **ep, **pp;
+    int i, ret, used = 0, attach = 0, gleader = -1, lpjob = -1;
+    short spflags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+    pid_t pgroup = 0, pid;
+
+    if (isset(XTRACE) || isset(RESTRICTED) || unset(EXECOPT) ||
+	STTYval || intrap || thisjob == -1 || thisjob >= jobtabsize - 1 ||
+	zgetenv("ARGV0"))
+	return 0;
+#ifdef HAVE_GETRLIMIT
+    for (i = 0; i < RLIM_NLIMITS; i++)
+	if (limits[i].rlim_max != current_limits[i].rlim_max ||
+	    limits[i].rlim_cur != current_limits[i].rlim_cur)
+	    return 0;
+#endif
+    for (node = firstnode(args); node; incnode(node))
+	if (has_token((char *) getdata(node)))
+	    return 0;
+
+    /* The same search as execute(), as far as it is certain */
+    arg0 = (char *) peekfirst(args);
+    if ((int) strlen(arg0) >= PATH_MAX)
+	return 0;
+    if (strchr(arg0, '/'))
+	pth = arg0;
+    else if ((cn = (Cmdnam) cmdnamtab->getnode(cmdnamtab, arg0))) {
+	if (cn->node.flags & HASHED)
+	    pth = cn->u.cmd;
+	else if (!cn->u.name)
+	    return 0;
+	else {
+	    /* relative directories earlier in the path are tried first */
+	    for (pp = path; pp < cn->u.name; pp++)
+		if (**pp != '/')
+		    return 0;
+	    pth = zhtricat(*cn->u.name, "/", cn->node.nam);
+	}
+    } else
+	return 0;
+
+    /* Process group and terminal as entersubsh() would set them */
+    if (isset(MONITOR)) {
+	spflags |= POSIX_SPAWN_SETPGROUP;
+	if (jobtab[list_pipe_job].gleader && (list_pipe || list_pipe_child)) {
+	    gleader = pgroup = jobtab[list_pipe_job].gleader;
+	    lpjob = list_pipe_job;
+	} else if (jobtab[thisjob].gleader)
+	    pgroup = jobtab[thisjob].gleader;
+	else {
+	    if (jobbing && interact && SHTTY != -1)
+		attach = 1;
+	    gleader = 0;
+	    if (list_pipe_job != thisjob)
+		lpjob = list_pipe_job;
+	}
+#ifndef HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDTCSETPGRP_NP
+	if (attach)
+	    return 0;
+#endif
+    }
+
+    if (posix_spawn_file_actions_init(&fa))
+	return 0;
+    ret = 0;
+#ifdef HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDTCSETPGRP_NP
+    if (attach && posix_spawn_file_actions_addtcsetpgrp_np(&fa, SHTTY))
+	goto out_fa;
+#endif
+    if (input) {
+	used |= 1 << 0;
+	if (posix_spawn_file_actions_adddup2(&fa, input, 0))
+	    goto out_fa;
+    }
+    if (output) {
+	used |= 1 << 1;
+	if (posix_spawn_file_actions_adddup2(&fa, output, 1))
+	    goto out_fa;
+    }
+    if (redir && !spawn_redirs(&fa, redir, used))
+	goto out_fa;
+    /* The descriptors closem() and entersubsh() would close */
+    for (i = 10; i <= max_zsh_fd; i++)
+	if (((fdtable[i] & FDT_TYPE_MASK) == FDT_INTERNAL ||
+	     (fdtable[i] & FDT_TYPE_MASK) == FDT_XTRACE ||
+	     (fdtable[i] & FDT_SAVED_MASK) ||
+	     i == coprocin || i == coprocout || i == close_if_forked) &&
+	    posix_spawn_file_actions_addclose(&fa, i))
+	    goto out_fa;
+
+    if (posix_spawnattr_init(&attr))
+	goto out_fa;
+    sigemptyset(&mask);
+    mask = signal_block(mask);
+    sigdelset(&mask, SIGCHLD);
+#ifdef SIGWINCH
+    sigdelset(&mask, SIGWINCH);
+#endif
+    sigemptyset(&sigdef);
+    sigaddset(&sigdef, SIGTTOU);
+    sigaddset(&sigdef, SIGTTIN);
+    sigaddset(&sigdef, SIGTSTP);
+    if (interact) {
+	sigaddset(&sigdef, SIGTERM);
+	if (!(sigtrapped[SIGINT] & ZSIG_IGNORED))
+	    sigaddset(&sigdef, SIGINT);
+	if (!(sigtrapped[SIGPIPE]))
+	    sigaddset(&sigdef, SIGPIPE);
+    }
+    if (!(sigtrapped[SIGQUIT] & ZSIG_IGNORED))
+	sigaddset(&sigdef, SIGQUIT);
+    if (posix_spawnattr_setflags(&attr, spflags) ||
+	posix_spawnattr_setsigmask(&attr, &mask) ||
+	posix_spawnattr_setsigdefault(&attr, &sigdef) ||
+	((spflags & POSIX_SPAWN_SETPGROUP) &&
+	 posix_spawnattr_setpgroup(&attr, pgroup)))
+	goto out_attr;
+
+    /* Arguments and environment as zexecve() passes them */
+    pth = unmetafy(dupstring(pth), NULL);
+    argv = (char **) zhalloc((countlinknodes(args) + 1) * sizeof(char *));
+    for (node = firstnode(args), pp = argv; node; incnode(node))
+	*pp++ = unmetafy(dupstring((char *) getdata(node)), NULL);
+    *pp = NULL;
+    if (*pth == '/')
+	underscore = dyncat("_=", pth);
+    else
+	underscore = zhtricat("_=", pwd, dyncat("/", pth));
+    for (ep = environ; *ep; ep++)
+	;
+    envp = (char **) zhalloc((ep - environ + 2) * sizeof(char *));
+    for (ep = environ, pp = envp; *ep; ep++)
+	if ((*ep)[0] == '_' && (*ep)[1] == '=') {
+	    *pp++ = underscore;
+	    underscore = NULL;
+	} else
+	    *pp++ = *ep;
+    if (underscore)
+	*pp++ = underscore;
+    *pp = NULL;
+
+    child_block();
+    gettimeofday(&bgtime, &dummy_tz);
+    queue_signals();
+    if (posix_spawn(&pid, pth, &fa, &attr, argv, envp))
+	pid = 0;
+    unqueue_signals();
+    if (pid) {
+	if (nonempty(EXECSTATSHOOK->funcs))
+	    execstats(EXST_FORK, NULL, 0.0);
+	addproc(pid, text, 0, &bgtime, gleader ? gleader : pid, lpjob);
+	if (oautocont >= 0)
+	    opts[AUTOCONTINUE] = oautocont;
+	pipecleanfilelist(jobtab[thisjob].filelist, 1);
+	ret = 1;
+    }
+
+ out_attr:
+    posix_spawnattr_destroy(&attr);
+ out_fa:
+    posix_spawn_file_actions_destroy(&fa);
+    return ret;
+}
+
+#endif /* USE_POSIX_SPAWN */
+
 /**/
 static int
 execcmd_fork(Estate state, int how, int type, Wordcode varspc,
@@ -3342,7 +3650,8 @@ execcmd_exec(Estate state, Execcmd_params eparams,
 
     /* Get the text associated with this command. */
     if (!text &&
-	(!sfcontext && (jobbing || (how & Z_TIMED))))
+	((!sfcontext && (jobbing || (how & Z_TIMED))) ||
+	 nonempty(EXECSTATSHOOK->funcs)))
 	text = getjobtext(state->prog, eparams->beg);
 
     /*
@@ -3520,6 +3829,14 @@ execcmd_exec(Estate state, Execcmd_params eparams,
 	    (((is_builtin || is_shfunc) && output) ||
 	     (!is_cursh && (last1 != 1 || nsigtrapped || havefiles() ||
 			    fdtable_flocks)))) {
+#ifdef USE_POSIX_SPAWN
+	    if (type == WC_SIMPLE && !is_cursh && !(how & Z_ASYNC) &&
+		!varspc && !eparams->htok && !use_defpath &&
+		!(cflags & (BINF_DASH | BINF_CLEARENV)) &&
+		execcmd_spawn(args, redir, input, output, text,
+			      oautocont, close_if_forked))
+		return;
+#endif
 	    switch (execcmd_fork(state, how, type, varspc, &filelist,
 				 text, oautocont, close_if_forked)) {
 	    case -1:
@@ -4089,7 +4406,17 @@ execcmd_exec(Estate state, Execcmd_params eparams,
 		}
 		dont_queue_signals();
 		if (!errflag) {
-		    int ret = execbuiltin(args, assigns, (Builtin) hn);
+		    int ret;
+
+		    if (nonempty(EXECSTATSHOOK->funcs)) {
+			char *bname = dupstring(hn->nam);
+			double beg = execstats_time();
+
+			ret = execbuiltin(args, assigns, (Builtin) hn);
+			execstats(EXST_BUILTIN, bname,
+				  execstats_time() - beg);
+		    } else
+			ret = execbuiltin(args, assigns, (Builtin) hn);
 		    /*
 		     * In case of interruption assume builtin status
 		     * is less useful than what interrupt set.
@@ -4569,6 +4896,7 @@ getoutput(char *cmd, int qt)
     int pipes[2];
     pid_t pid;
     char *s;
+    double beg = -1.0;
 
     int onc = nocomments;
     nocomments = (interact && unset(INTERACTIVECOMMENTS));
@@ -4607,6 +4935,8 @@ getoutput(char *cmd, int qt)
     }
     child_block();
     cmdoutval = 0;
+    if (nonempty(EXECSTATSHOOK->funcs))
+	beg = execstats_time();
     if ((cmdoutpid = pid = zfork(NULL)) == -1) {
 	/* fork error */
 	zclose(pipes[0]);
@@ -4623,6 +4953,8 @@ getoutput(char *cmd, int qt)
 	fdtable[pipes[0]] = FDT_UNUSED;
 	waitforpid(pid, 0);		/* unblocks */
 	lastval = cmdoutval;
+	if (beg >= 0.0 && nonempty(EXECSTATSHOOK->funcs))
+	    execstats(EXST_SUBST, NULL, execstats_time() - beg);
 	return retval;
     }
     /* pid == 0 */
@@ -462,6 +462,141 @@ insert(char *s, int checked)
     return;
 }
 
+/*
+ * Cache of directory listings.  This is only used while glob_dircache
+ * is set, which the completion code does while calling completion
+ * functions:  these often glob the same directories several times for
+ * one completion attempt and again on the next key press.
+ *
+ * A listing is reused only if the directory's modification time is
+ * unchanged and the listing was read more than a second after that
+ * time, so that a change made in the same second cannot be missed.
+ * Listings are also dropped after DIRCACHE_TTL seconds, and all of
+ * them when the outermost completion function returns.
+ *
+ * A scan holds a reference to the listing it is reading, since the
+ * code run for glob qualifiers can glob again and push the listing
+ * out of the cache; it is then only freed when the scan is done.
+ */
+
+/**/
+mod_export int glob_dircache;
+
+#define DIRCACHE_MAX	16
+#define DIRCACHE_TTL	30
+
+struct dircache {
+    struct dircache *next;
+    dev_t dev;
+    ino_t ino;
+    time_t mtime;
+    time_t when;		/* when the directory was read	*/
+    char **names;		/* metafied, without . and ..	*/
+    int refs;			/* scans reading the listing	*/
+    int dropped;		/* no longer in the cache	*/
+};
+
+static struct dircache *dircache;
+
+/* Free a listing taken out of the cache, unless it's still being read */
+
+static void
+dircachedrop(struct dircache *d)
+{
+    if (d->refs) {
+	d->dropped = 1;
+	return;
+    }
+    freearray(d->names);
+    zfree(d, sizeof(*d));
+}
+
+/* Finish reading a listing returned by dircachelist() */
+
+static void
+dircacheunref(struct dircache *d)
+{
+    if (!--d->refs && d->dropped)
+	dircachedrop(d);
+}
+
+/* Empty the cache of directory listings */
+
+/**/
+mod_export void
+freedircache(void)
+{
+    struct dircache *d;
+
+    while ((d = dircache)) {
+	dircache = d->next;
+	dircachedrop(d);
+    }
+}
+
+/* Return the cached listing of directory fn, reading it if needed,   *
+ * with a reference held for the caller to release with               *
+ * dircacheunref().  Returns NULL if the directory can't be read.      */
+
+static struct dircache *
+dircachelist(char *fn)
+{
+    struct dircache *d, **dp;
+    struct stat st;
+    time_t now = time(NULL);
+    DIR *dir;
+    char *n, **names;
+    int cnt, sz;
+
+    if (stat(fn, &st))
+	return NULL;
+    for (dp = &dircache; (d = *dp); dp = &d->next) {
+	if (d->dev == st.st_dev && d->ino == st.st_ino) {
+	    *dp = d->next;
+	    if (d->mtime == st.st_mtime && d->when > st.st_mtime + 1 &&
+		now - d->when < DIRCACHE_TTL) {
+		d->next = dircache;
+		dircache = d;
+		d->refs++;
+		return d;
+	    }
+	    dircachedrop(d);
+	    break;
+	}
+    }
+    if (!(dir = opendir(fn)))
+	return NULL;
+    names = (char **) zalloc((sz = 64) * sizeof(char *));
+    for (cnt = 0; (n = zreaddir(dir, 1)); cnt++) {
+	if (cnt + 1 == sz)
+	    names = (char **) zrealloc(names, (sz *= 2) * sizeof(char *));
+	names[cnt] = ztrdup(n);
+    }
+    names[cnt] = NULL;
+    closedir(dir);
+
+    d = (struct dircache *) zshcalloc(sizeof(*d));
+    d->dev = st.st_dev;
+    d->ino = st.st_ino;
+    d->mtime = st.st_mtime;
+    d->when = now;
+    d->names = names;
+    d->refs = 1;
+    d->next = dircache;
+    dircache = d;
+
+    for (cnt = 1; d->next; d = d->next, cnt++) {
+	if (cnt == DIRCACHE_MAX) {
+	    struct dircache *e = d->next;
+
+	    d->next = e->next;
+	    dircachedrop(e);
+	    break;
+	}
+    }
+    return dircache;
+}
+
 /* Do the globbing:  scanner is called recursively *
  * with successive bits of the path until we've    *
  * tried all of it.                                */
@@ -552,13 +687,16 @@ scanner(Complist q, int shortcircuit)
 	/* Do pattern matching on current path section. */
 	char *fn = pathbuf[pathbufcwd] ? unmeta(pathbuf + pathbufcwd) : ".";
 	int dirs = !!q->next;
-	DIR *lock = opendir(fn);
-	char *subdirs = NULL;
+	DIR *lock = NULL;
+	struct dircache *dc = NULL;
+	char **names = NULL, *subdirs = NULL;
 	int subdirlen = 0;
 
-	if (lock == NULL)
+	if (glob_dircache && (dc = dircachelist(fn)))
+	    names = dc->names;
+	else if (!(lock = opendir(fn)))
 	    return;
-	while ((fn = zreaddir(lock, 1)) && !errflag) {
+	while ((fn = names ? *names++ : zreaddir(lock, 1)) && !errflag) {
 	    /* prefix and suffix are zle trickery */
 	    if (!dirs && !colonmod &&
 		((glob_pre && !strpfx(glob_pre, fn))
@@ -638,13 +776,19 @@ scanner(Complist q, int shortcircuit)
 		    /* if the last filename component, just add it */
 		    insert(fn, 1);
 		    if (shortcircuit && shortcircuit == matchct) {
-			closedir(lock);
+			if (lock)
+			    closedir(lock);
+			if (dc)
+			    dircacheunref(dc);
 			return;
 		    }
 		}
 	    }
 	}
-	closedir(lock);
+	if (lock)
+	    closedir(lock);
+	if (dc)
+	    dircacheunref(dc);
 	if (subdirs) {
 	    int oppos = pathpos;
 
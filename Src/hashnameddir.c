@@ -152,6 +152,9 @@ add_userdir(int status, char *key, int keylen, char *val, int vallen, char *dumm
 static void
 fillnameddirtable(UNUSED(HashTable ht))
 {
+    int st = allusersadded ? -1 :
+	starttrace_begin("fillnameddirtable", NULL);
+
     if (!allusersadded) {
 #if defined(HAVE_NIS) || defined(HAVE_NIS_PLUS)
 	FILE *pwf;
@@ -233,6 +236,7 @@ fillnameddirtable(UNUSED(HashTable ht))
 #endif
 	allusersadded = 1;
     }
+    starttrace_end(st);
 }
 
 /* Add an entry to the named directory hash *
@@ -41,6 +41,8 @@
 
 #define HASHTABLE_INTERNAL_MEMBERS \
     ScanStatus scan;		/* status of a scan over this hashtable     */ \
+    HashNode *pfxidx;		/* nodes sorted by name, see prefixnodes()  */ \
+    int pfxct;			/* number of nodes in pfxidx                */ \
     HASHTABLE_DEBUG_MEMBERS
 
 typedef struct scanstatus *ScanStatus;
@@ -124,6 +126,7 @@ mod_export void
 deletehashtable(HashTable ht)
 {
     ht->emptytable(ht);
+    dropprefixindex(ht);
 #ifdef ZSH_HASH_DEBUG
     if(ht->next)
 	ht->next->last = ht->last;
@@ -167,6 +170,7 @@ addhashnode2(HashTable ht, char *nam, void *nodeptr)
 
     hn = (HashNode) nodeptr;
     hn->nam = nam;
+    dropprefixindex(ht);
 
     hashval = ht->hash(hn->nam) % ht->hsize;
     hp = ht->nodes[hashval];
@@ -284,6 +288,7 @@ removehashnode(HashTable ht, const char *nam)
 	ht->nodes[hashval] = hp->next;
 	gotit:
 	ht->ct--;
+	dropprefixindex(ht);
 	if(ht->scan) {
 	    if(ht->scan->sorted) {
 		HashNode *hashtab = ht->scan->u.s.hashtab;
@@ -340,6 +345,69 @@ hnamcmp(const void *ap, const void *bp)
     return ztrcmp(a->nam, b->nam);
 }
 
+/* Compare the names of two nodes byte by byte, so that names with *
+ * a common prefix are sorted next to each other.                   */
+
+/**/
+static int
+hnambytecmp(const void *ap, const void *bp)
+{
+    return strcmp((*(HashNode *)ap)->nam, (*(HashNode *)bp)->nam);
+}
+
+/* Forget the sorted index of a hash table after it has changed. */
+
+/**/
+static void
+dropprefixindex(HashTable ht)
+{
+    if (ht->pfxidx) {
+	zfree(ht->pfxidx, ht->pfxct * sizeof(HashNode));
+	ht->pfxidx = NULL;
+    }
+}
+
+/* Get the nodes of a hash table whose names start with pfx, sorted   *
+ * by name, in a NULL-terminated heap array.  This uses an index of   *
+ * the nodes sorted by name that is built on first use and dropped    *
+ * whenever a node is added or removed, so repeated lookups in a      *
+ * table that doesn't change only visit the nodes that are returned. */
+
+/**/
+mod_export HashNode *
+prefixnodes(HashTable ht, const char *pfx)
+{
+    HashNode *ret, *idx, hn;
+    int i, lo, hi, pl = strlen(pfx);
+
+    if (!ht->pfxidx) {
+	ht->pfxidx = idx = (HashNode *) zalloc((ht->ct + 1) *
+					       sizeof(HashNode));
+	ht->pfxct = ht->ct + 1;
+	for (i = 0; i < ht->hsize; i++)
+	    for (hn = ht->nodes[i]; hn; hn = hn->next)
+		*idx++ = hn;
+	qsort((void *) ht->pfxidx, ht->ct, sizeof(HashNode), hnambytecmp);
+    }
+    idx = ht->pfxidx;
+
+    /* Find the first name not sorted before pfx. */
+    for (lo = 0, hi = ht->ct; lo < hi; ) {
+	i = (lo + hi) / 2;
+	if (strcmp(idx[i]->nam, pfx) < 0)
+	    lo = i + 1;
+	else
+	    hi = i;
+    }
+    for (hi = lo; hi < ht->ct && !strncmp(idx[hi]->nam, pfx, pl); hi++);
+
+    ret = (HashNode *) zhalloc((hi - lo + 1) * sizeof(HashNode));
+    memcpy(ret, idx + lo, (hi - lo) * sizeof(HashNode));
+    ret[hi - lo] = NULL;
+
+    return ret;
+}
+
 /* Scan the nodes in a hash table and execute scanfunc on nodes based on
  * the flags that are set/unset.  scanflags is passed unchanged to
  * scanfunc (if executed).
@@ -505,6 +573,7 @@ resizehashtable(HashTable ht, int newsize)
     }
 
     ht->ct = 0;
+    dropprefixindex(ht);
 }
 
 /* Generic method to empty a hash table */
@@ -95,6 +95,7 @@ mod_export struct hookdef zshhooks[] = {
     HOOKDEF("before_trap", NULL, HOOKF_ALL),
     HOOKDEF("after_trap", NULL, HOOKF_ALL),
     HOOKDEF("get_color_attr", NULL, HOOKF_ALL),
+    HOOKDEF("exec_stats", NULL, HOOKF_ALL),
 };
 
 /* keep executing lists until EOF found */
@@ -697,11 +698,18 @@ init_io(char *cmd)
 #endif
 }
 
+/*
+ * Size of the buffer for output to the terminal.  The line editor
+ * flushes it once per refresh, so make it large enough for redrawing
+ * a big screen full of highlighted text to go out in a single write.
+ */
+#define SHOUTBUFSIZ	65536
+
 /**/
 mod_export void
 init_shout(void)
 {
-    static char shoutbuf[BUFSIZ];
+    static char shoutbuf[SHOUTBUFSIZ];
 #if defined(JOB_CONTROL) && defined(TIOCSETD) && defined(NTTYDISC)
     int ldisc;
 #endif
@@ -722,7 +730,7 @@ init_shout(void)
     shout = fdopen(SHTTY, "w");
 #ifdef _IOFBF
     if (shout)
-	setvbuf(shout, shoutbuf, _IOFBF, BUFSIZ);
+	setvbuf(shout, shoutbuf, _IOFBF, SHOUTBUFSIZ);
 #endif
   
     gettyinfo(&shttyinfo);	/* get tty state */
@@ -1268,6 +1276,150 @@ init_signals(void)
     }
 }
 
+/*
+ * Startup timeline.  If ZSH_STARTUP_TRACE is set in the environment
+ * when the shell starts, the time taken by each phase of initialisation,
+ * each file sourced and each module loaded is recorded until the shell
+ * is ready to read commands.  The table is then appended to the file
+ * named by the variable, or written to standard error if it is empty.
+ * Nested entries are indented under the one they were part of.
+ */
+
+struct starttrace {
+    char *what;			/* kind of entry, not allocated */
+    char *name;			/* file or module name, or NULL */
+    int depth;
+    double beg, end;		/* milliseconds since startup */
+};
+
+static struct starttrace *starttrace;
+static int starttrace_ct, starttrace_size, starttrace_depth;
+static double starttrace_zero;
+static char *starttrace_file;
+
+/* Non-zero while the startup timeline is being recorded. */
+
+/**/
+int starttrace_on;
+
+static double
+starttrace_time(void)
+{
+    struct timespec ts;
+
+    zmonotime(&ts);
+    return ((double) ts.tv_sec) * 1000.0 + ((double) ts.tv_nsec) / 1000000.0
+	- starttrace_zero;
+}
+
+/* Start recording the timeline if ZSH_STARTUP_TRACE is set. */
+
+static void
+starttrace_init(void)
+{
+    char *f = getenv("ZSH_STARTUP_TRACE");
+
+    if (!f)
+	return;
+    starttrace_zero = 0.0;
+    starttrace_zero = starttrace_time();
+    starttrace_file = ztrdup(f);
+    starttrace_on = 1;
+}
+
+/*
+ * Note the start of an entry in the timeline; what is a static string
+ * naming the phase or the kind of entry, name is copied if not NULL.
+ * Returns the index to be passed to starttrace_end(), or -1 if the
+ * timeline isn't being recorded.
+ */
+
+/**/
+int
+starttrace_begin(char *what, char *name)
+{
+    struct starttrace *st;
+
+    if (!starttrace_on)
+	return -1;
+    if (starttrace_ct == starttrace_size) {
+	int osize = starttrace_size;
+
+	starttrace_size = osize ? osize * 2 : 32;
+	starttrace = (struct starttrace *)
+	    zrealloc(starttrace, starttrace_size * sizeof(*starttrace));
+	memset(starttrace + osize, 0,
+	       (starttrace_size - osize) * sizeof(*starttrace));
+    }
+    st = starttrace + starttrace_ct;
+    st->what = what;
+    st->name = name ? ztrdup(unmeta(name)) : NULL;
+    st->depth = starttrace_depth++;
+    st->beg = starttrace_time();
+    st->end = -1.0;
+    return starttrace_ct++;
+}
+
+/**/
+void
+starttrace_end(int i)
+{
+    if (i < 0 || !starttrace_on)
+	return;
+    starttrace[i].end = starttrace_time();
+    starttrace_depth = starttrace[i].depth;
+}
+
+/*
+ * Stop recording and write out the timeline.  Entries that are
+ * still open, such as a file that ran a command with -c, are shown
+ * as lasting until now.
+ */
+
+/**/
+void
+starttrace_done(void)
+{
+    FILE *out = stderr;
+    double now;
+    int i;
+
+    if (!starttrace_on)
+	return;
+    starttrace_on = 0;
+    now = starttrace_time();
+    if (*starttrace_file &&
+	!(out = fopen(starttrace_file, "a"))) {
+	zwarn("can't write startup trace to %s: %e",
+	      starttrace_file, errno);
+	out = NULL;
+    }
+    if (out) {
+	fprintf(out, "# zsh startup trace, pid %ld: %.3f ms\n",
+		(long) getpid(), now);
+	fprintf(out, "#    start   elapsed  what\n");
+	for (i = 0; i < starttrace_ct; i++) {
+	    struct starttrace *st = starttrace + i;
+
+	    fprintf(out, "%10.3f %9.3f  %*s%s%s%s\n", st->beg,
+		    (st->end < 0.0 ? now : st->end) - st->beg,
+		    2 * st->depth, "", st->what,
+		    st->name ? " " : "", st->name ? st->name : "");
+	}
+	if (out == stderr)
+	    fflush(out);
+	else
+	    fclose(out);
+    }
+    for (i = 0; i < starttrace_ct; i++)
+	zsfree(starttrace[i].name);
+    zfree(starttrace, starttrace_size * sizeof(*starttrace));
+    starttrace = NULL;
+    starttrace_ct = starttrace_size = starttrace_depth = 0;
+    zsfree(starttrace_file);
+    starttrace_file = NULL;
+}
+
 /* Source the init scripts.  If called as "ksh" or "sh"  *
  * then we source the standard sh/ksh scripts instead of *
  * the standard zsh scripts                              */
@@ -1366,13 +1518,18 @@ init_misc(char *cmd, char *zsh_name)
 	    fclose(bshin);
 	SHIN = movefd(open("/dev/null", O_RDONLY | O_NOCTTY));
 	bshin = fdopen(SHIN, "r");
+	starttrace_done();
 	execstring(cmd, 0, 1, "cmdarg");
 	stopmsg = 1;
 	zexit((exit_pending || shell_exiting) ? exit_val : lastval, 0);
     }
 
-    if (interact && isset(RCS))
+    if (interact && isset(RCS)) {
+	int st = starttrace_begin("readhistfile", NULL);
+
 	readhistfile(NULL, 0, HFILE_USE_OPTIONS);
+	starttrace_end(st);
+    }
 }
 
 /*
@@ -1396,12 +1553,14 @@ source(char *s)
     int otrap_return = trap_return, otrap_state = trap_state;
     struct funcstack fstack;
     enum source_return ret = SOURCE_OK;
+    int st;
 
     if (!s || 
 	(!(prog = try_source_file((us = unmeta(s)))) &&
 	 (tempfd = movefd(open(us, O_RDONLY | O_NOCTTY))) == -1)) {
 	return SOURCE_NOT_FOUND;
     }
+    st = starttrace_begin("source", s);
 
     /* save the current shell state */
     fd        = SHIN;            /* store the shell input fd                  */
@@ -1504,6 +1663,7 @@ source(char *s)
     zfree(cmdstack, CMDSTACKSZ);
     cmdstack = ocs;
     cmdsp = ocsp;
+    starttrace_end(st);
 
     return ret;
 }
@@ -1693,11 +1853,12 @@ zsh_main(UNUSED(int argc), char **argv)
 {
     char **t, *runscript = NULL, *zsh_name;
     char *cmd;			/* argument to -c */
-    int t0;
+    int t0, st;
 #ifdef USE_LOCALE
     setlocale(LC_ALL, "");
 #endif
 
+    starttrace_init();
     init_jobs(argv, environ);
 
     /*
@@ -1739,18 +1900,31 @@ zsh_main(UNUSED(int argc), char **argv)
     createoptiontable();
     /* sets emulation, LOGINSHELL, PRIVILEGED, ZLE, INTERACTIVE,
      * SHINSTDIN and SINGLECOMMAND */ 
+    st = starttrace_begin("parseargs", NULL);
     parseargs(zsh_name, argv, &runscript, &cmd);
+    starttrace_end(st);
 
     SHTTY = -1;
+    st = starttrace_begin("init_io", NULL);
     init_io(cmd);
+    starttrace_end(st);
+    st = starttrace_begin("setupvals", NULL);
     setupvals(cmd, runscript, zsh_name);
+    starttrace_end(st);
 
     init_signals();
+    st = starttrace_begin("init_bltinmods", NULL);
     init_bltinmods();
+    starttrace_end(st);
     init_builtins();
+    st = starttrace_begin("run_init_scripts", NULL);
     run_init_scripts();
+    starttrace_end(st);
     setupshin(runscript);
+    st = starttrace_begin("init_misc", NULL);
     init_misc(cmd, zsh_name);
+    starttrace_end(st);
+    starttrace_done();
 
     for (;;) {
 	/*
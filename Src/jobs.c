@@ -1415,6 +1415,18 @@ freejob(Job jn, int deleting)
 void
 deletejob(Job jn, int disowning)
 {
+    if (!disowning && nonempty(EXECSTATSHOOK->funcs)) {
+	Process pn;
+	struct timeval dtimeval;
+
+	for (pn = jn->procs; pn; pn = pn->next)
+	    if (pn->status != SP_RUNNING && !WIFSTOPPED(pn->status)) {
+		dtime(&dtimeval, &pn->bgtime, &pn->endtime);
+		execstats(EXST_FORKED, pn->text,
+			  (double) dtimeval.tv_sec +
+			  (double) dtimeval.tv_usec / 1000000.0);
+	    }
+    }
     deletefilelist(jn->filelist, disowning);
     if (jn->stat & STAT_ATTACH) {
 	attachtty(mypgrp);
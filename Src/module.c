@@ -2193,6 +2193,22 @@ modname_ok(char const *p)
 /**/
 mod_export int
 load_module(char const *name, Feature_enables enablesarr, int silent)
+{
+    int ret, st;
+
+    if (!starttrace_on || module_loaded(name))
+	return load_module_features(name, enablesarr, silent);
+    st = starttrace_begin("module", (char *) name);
+    ret = load_module_features(name, enablesarr, silent);
+    starttrace_end(st);
+    return ret;
+}
+
+/* Do the work of load_module(), which adds the startup timeline. */
+
+/**/
+static int
+load_module_features(char const *name, Feature_enables enablesarr, int silent)
 {
     Module m;
     void *handle = NULL;
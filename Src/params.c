@@ -2327,7 +2327,15 @@ getstrvalue(Value v)
     if (v->start == 0 && v->end == -1)
 	return s;
 
-    len = strlen(s);
+    /*
+     * With both ends counted from the start we don't need to look
+     * beyond the end of the range, which matters for long values.
+     */
+    if (v->start >= 0 && v->end >= 0) {
+	char *eptr = memchr(s, '\0', v->end);
+	len = eptr ? eptr - s : v->end;
+    } else
+	len = strlen(s);
     if (v->start < 0) {
 	v->start += len;
 	if (v->start < 0)
@@ -4581,6 +4589,7 @@ setlang(char *x)
     for (ln = lc_names; ln->name; ln++)
 	if ((x = getsparam_u(ln->name)) && *x)
 	    setlocale(ln->category, x);
+    clearwidthcache();
     unqueue_signals();
 }
 
@@ -4602,8 +4611,10 @@ lc_allsetfn(Param pm, char *x)
 	    unqueue_signals();
 	}
     }
-    else
+    else {
 	setlocale(LC_ALL, unmeta(x));
+	clearwidthcache();
+    }
 }
 
 /**/
@@ -4638,6 +4649,7 @@ lcsetfn(Param pm, char *x)
 	for (ln = lc_names; ln->name; ln++)
 	    if (!strcmp(ln->name, pm->node.nam))
 		setlocale(ln->category, unmeta(x));
+	clearwidthcache();
     }
     unqueue_signals();
 }
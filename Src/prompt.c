@@ -1071,12 +1071,31 @@ putstr(int d)
  * by locating them and finding out their screen width.
  */
 
+/*
+ * The line editor counts the same left and right prompts on every
+ * refresh, so remember the results for the last few strings.
+ * Entries are only valid for the terminal width and character
+ * widths (see clearwidthcache()) in force when they were made.
+ */
+
+#define COUNTPROMPT_CACHE_SIZE	4
+
+static struct countpromptcache {
+    char *str;
+    int overf, termcols, wserial;
+    int w, h;
+} cpcache[COUNTPROMPT_CACHE_SIZE];
+
+static int cpcache_next;
+
 /**/
 mod_export void
 countprompt(char *str, int *wp, int *hp, int overf)
 {
     int w = 0, h = 1, multi = 0;
     int s = 1;
+    char *start = str;
+    struct countpromptcache *cpc;
 #ifdef MULTIBYTE_SUPPORT
     int wcw;
     char inchar;
@@ -1086,6 +1105,18 @@ countprompt(char *str, int *wp, int *hp, int overf)
     memset(&mbs, 0, sizeof(mbs));
 #endif
 
+    for (cpc = cpcache; cpc < cpcache + COUNTPROMPT_CACHE_SIZE; cpc++) {
+	if (cpc->str && cpc->overf == overf &&
+	    cpc->termcols == zterm_columns &&
+	    cpc->wserial == widthcacheserial && !strcmp(cpc->str, str)) {
+	    if (wp)
+		*wp = cpc->w;
+	    if (hp)
+		*hp = cpc->h;
+	    return;
+	}
+    }
+
     for (; *str; str++) {
 	/*
 	 * Avoid double-incrementing the height when there's a newline in the
@@ -1130,6 +1161,10 @@ countprompt(char *str, int *wp, int *hp, int overf)
 			w = 0;
 			h++;
 			continue;
+		    } else if (*str >= 0x20 && *str < 0x7f) {
+			/* Printable ASCII: no need to convert. */
+			w++;
+			continue;
 		    }
 #ifdef MULTIBYTE_SUPPORT
 		}
@@ -1182,6 +1217,17 @@ countprompt(char *str, int *wp, int *hp, int overf)
 	    h++;
 	}
     }
+
+    cpc = cpcache + cpcache_next;
+    cpcache_next = (cpcache_next + 1) % COUNTPROMPT_CACHE_SIZE;
+    zsfree(cpc->str);
+    cpc->str = ztrdup(start);
+    cpc->overf = overf;
+    cpc->termcols = zterm_columns;
+    cpc->wserial = widthcacheserial;
+    cpc->w = w;
+    cpc->h = h;
+
     if(wp)
 	*wp = w;
     if(hp)
@@ -796,9 +796,65 @@ zwcwidth(wint_t wc)
     return wcw;
 }
 
+/*
+ * Cache of character widths for the current locale, covering the
+ * Basic and Supplementary Multilingual Planes where nearly all the
+ * characters seen in prompts and on the command line live.  Entries
+ * hold the width plus 2, so that zero means "not yet looked up".
+ */
+
+#define WCWIDTH_CACHE_SIZE	0x20000
+
+static unsigned char wcwidth_cache[WCWIDTH_CACHE_SIZE];
+
+/*
+ * Width of a wide character as returned by wcwidth() (or by the
+ * Unicode 9 replacement), i.e. -1 for unprintable characters.
+ * This is what WCWIDTH() uses for anything other than printable ASCII.
+ */
+
+/**/
+mod_export int
+mb_wcwidth(wchar_t wc)
+{
+    int wcw;
+
+    if ((unsigned long)wc >= WCWIDTH_CACHE_SIZE)
+	return WCWIDTH_RAW(wc);
+    if ((wcw = wcwidth_cache[wc]))
+	return wcw - 2;
+    wcw = WCWIDTH_RAW(wc);
+    /* Don't cache anything we can't represent */
+    if (wcw >= -1 && wcw <= 2)
+	wcwidth_cache[wc] = (unsigned char)(wcw + 2);
+    return wcw;
+}
+
 /**/
 #endif /* MULTIBYTE_SUPPORT */
 
+/*
+ * Serial number for cached display widths, incremented whenever
+ * they may have changed, e.g. because the locale was altered.
+ * Anything caching widths of strings (such as countprompt())
+ * compares against this.
+ */
+
+/**/
+mod_export int widthcacheserial;
+
+/* Throw away cached character widths. */
+
+/**/
+mod_export void
+clearwidthcache(void)
+{
+#ifdef MULTIBYTE_SUPPORT
+    memset(wcwidth_cache, 0, sizeof(wcwidth_cache));
+#endif
+    widthcacheserial++;
+}
+
 /*
  * Search the path for prog and return the file name.
  * The returned value is unmetafied and in the unmeta storage
@@ -1143,6 +1199,7 @@ get_username(void)
 static char *finddir_full;
 static Nameddir finddir_last;
 static int finddir_best;
+static int finddir_cached;
 
 /* ScanFunc used by finddir(). */
 
@@ -1174,7 +1231,7 @@ finddir(char *s)
     static struct nameddir homenode = { {NULL, "", 0}, NULL, 0 };
     static int ffsz;
     char **ares;
-    int len;
+    int len, hooked;
 
     /* Invalidate directory cache if argument is NULL.  This is called *
      * whenever a node is added to or removed from the hash table, and *
@@ -1187,19 +1244,23 @@ finddir(char *s)
 	if(!finddir_full)
 	    finddir_full = zalloc(ffsz = PATH_MAX+1);
 	finddir_full[0] = 0;
+	finddir_cached = 0;
 	return finddir_last = NULL;
     }
 
-#if 0
     /*
      * It's not safe to use the cache while we have function
-     * transformations, and it's not clear it's worth the
-     * complexity of guessing here whether subst_string_by_hook
-     * is going to turn up the goods.
+     * transformations, since the function can give a different
+     * answer each time and its result is on the heap.  Without
+     * them, the result only depends on the named directory table
+     * and $HOME, and changes to those call us to empty the cache.
+     * This saves scanning the table every time the prompt
+     * shows the current directory.
      */
-    if (!strcmp(s, finddir_full) && *finddir_full)
+    hooked = getshfunc("zsh_directory_name") ||
+	getaparam("zsh_directory_name_functions");
+    if (!hooked && finddir_cached && !strcmp(s, finddir_full))
 	return finddir_last;
-#endif
 
     if ((int)strlen(s) >= ffsz) {
 	free(finddir_full);
@@ -1210,16 +1271,20 @@ finddir(char *s)
     finddir_last=NULL;
     finddir_scan(&homenode.node, 0);
     scanhashtable(nameddirtab, 0, 0, 0, finddir_scan, 0);
-
-    ares = subst_string_by_hook("zsh_directory_name", "d", finddir_full);
-    if (ares && arrlen_ge(ares, 2) &&
-	(len = (int)zstrtol(ares[1], NULL, 10)) > finddir_best) {
-	/* better duplicate this string since it's come from REPLY */
-	finddir_last = (Nameddir)hcalloc(sizeof(struct nameddir));
-	finddir_last->node.nam = zhtricat("[", dupstring(ares[0]), "]");
-	finddir_last->dir = dupstrpfx(finddir_full, len);
-	finddir_last->diff = len - strlen(finddir_last->node.nam);
-	finddir_best = len;
+    finddir_cached = !hooked;
+
+    if (hooked) {
+	ares = subst_string_by_hook("zsh_directory_name", "d",
+				    finddir_full);
+	if (ares && arrlen_ge(ares, 2) &&
+	    (len = (int)zstrtol(ares[1], NULL, 10)) > finddir_best) {
+	    /* better duplicate this string since it's come from REPLY */
+	    finddir_last = (Nameddir)hcalloc(sizeof(struct nameddir));
+	    finddir_last->node.nam = zhtricat("[", dupstring(ares[0]), "]");
+	    finddir_last->dir = dupstrpfx(finddir_full, len);
+	    finddir_last->diff = len - strlen(finddir_last->node.nam);
+	    finddir_best = len;
+	}
     }
 
     return finddir_last;
@@ -5283,6 +5348,15 @@ mb_niceformat(const char *s, FILE *stream, char **outstrp, int flags)
     char *ums, *ptr, *fmt, *outstr, *outptr;
     mbstate_t mbs;
 
+    if (!stream && !outstrp) {
+	/* Only the width is wanted: that of printable ASCII is its length. */
+	const char *t;
+
+	for (t = s; *t >= ' ' && *t <= '~'; t++)
+	    ;
+	if (!*t)
+	    return t - s;
+    }
     if (outstrp) {
 	outleft = outalloc = 5 * strlen(s);
 	outptr = outstr = zalloc(outalloc);
@@ -3226,6 +3226,24 @@ enum {
 #define BEFORETRAPHOOK (zshhooks + 1)
 #define AFTERTRAPHOOK  (zshhooks + 2)
 #define GETCOLORATTR   (zshhooks + 3)
+#define EXECSTATSHOOK  (zshhooks + 4)
+
+/* Argument to the exec_stats hook, run for each command if there are *
+ * any hook functions.  Times are durations in seconds, not clock     *
+ * readings, so can't be compared with $EPOCHREALTIME.                */
+
+enum {
+    EXST_BUILTIN,		/* a builtin run in this shell */
+    EXST_FORKED,		/* a forked process, name is the job text */
+    EXST_SUBST,			/* a command substitution $(...) */
+    EXST_FORK			/* a fork, no time */
+};
+
+struct execstats {
+    int type;
+    char *name;
+    double time;
+};
 
 #ifdef MULTIBYTE_SUPPORT
 /* Final argument to mb_niceformat() */
@@ -3260,10 +3278,18 @@ typedef wint_t convchar_t;
  * works on MacOS which doesn't define that.
  */
 #ifdef ENABLE_UNICODE9
-#define WCWIDTH(wc)	u9_wcwidth(wc)
+#define WCWIDTH_RAW(wc)	u9_wcwidth(wc)
 #else
-#define WCWIDTH(wc)	wcwidth(wc)
+#define WCWIDTH_RAW(wc)	wcwidth(wc)
 #endif
+/*
+ * Widths are looked up on every redraw, so printable ASCII is
+ * short-circuited and other characters go through a table that
+ * caches the result for the current locale (see mb_wcwidth()).
+ * The argument may be evaluated more than once.
+ */
+#define WCWIDTH(wc)	\
+    (((wc) >= 0x20 && (wc) < 0x7f) ? 1 : mb_wcwidth(wc))
 /*
  * Note WCWIDTH_WINT() takes wint_t, typically as a convchar_t.
  * It's written to use the wint_t from mb_metacharlenconv() without